@@ -7,6 +7,7 @@
 //
 
 #include "sio_client_impl.h"
+#include <websocketpp/utf8_validator.hpp>
 #include <functional>
 #include <sstream>
 #include <chrono>
@@ -39,13 +40,21 @@ namespace sio
         m_reconn_delay(5000),
         m_reconn_delay_max(25000),
         m_reconn_attempts(0xFFFFFFFF),
-        m_reconn_made(0)
+        m_reconn_made(0),
+        m_coalesce_writes(options.coalesce_writes),
+        m_coalesce_window_us(options.coalesce_window_us),
+        m_coalesce_flush_pending(false),
+        m_encode_threshold(options.encode_threshold)
     {
         using websocketpp::log::alevel;
 #ifndef DEBUG
         m_client.clear_access_channels(alevel::all);
         m_client.set_access_channels(alevel::connect|alevel::disconnect|alevel::app);
 #endif
+        if(options.encode_threads > 0)
+        {
+            m_encode_pool.reset(new encode_pool(options.encode_threads));
+        }
         // Initialize the Asio transport policy
         if (options.io_context != nullptr) {
             m_client.init_asio(options.io_context);
@@ -56,6 +65,7 @@ namespace sio
         // Bind the clients we are using
         using std::placeholders::_1;
         using std::placeholders::_2;
+        using std::placeholders::_3;
         m_client.set_open_handler(std::bind(&client_impl::on_open,this,_1));
         m_client.set_close_handler(std::bind(&client_impl::on_close,this,_1));
         m_client.set_fail_handler(std::bind(&client_impl::on_fail,this,_1));
@@ -66,6 +76,12 @@ namespace sio
         m_packet_mgr.set_decode_callback(std::bind(&client_impl::on_decode,this,_1));
 
         m_packet_mgr.set_encode_callback(std::bind(&client_impl::on_encode,this,_1,_2));
+
+        m_packet_mgr.set_lazy_decode(options.lazy_messages);
+        m_packet_mgr.set_arena_decode(options.arena_messages);
+
+        m_packet_mgr.set_event_filter(std::bind(&client_impl::wants_event,this,_1,_2));
+        m_packet_mgr.set_stream_callback(std::bind(&client_impl::on_stream,this,_1,_2,_3));
     }
     
     client_impl::~client_impl()
@@ -201,6 +217,66 @@ namespace sio
         m_packet_mgr.encode(p);
     }
 
+    //Called on the emitting thread. Large packets go to the encode pool instead.
+    void client_impl::encode_outbound(packet& p,encoded_packet& out)
+    {
+        if(m_encode_pool && p.is_larger_than(m_encode_threshold))
+        {
+            out.job = make_shared<encode_pool::job>(std::move(p));
+            m_encode_pool->submit(out.job,std::bind(&client_impl::on_pool_encoded,this));
+            return;
+        }
+        vector<packet_manager::encoded_frame>& frames = out.frames;
+        m_packet_mgr.encode(p,[&frames](bool isBinary,shared_ptr<const string> const& payload)
+        {
+            frames.push_back(packet_manager::encoded_frame(isBinary,payload));
+        });
+    }
+
+    //Network thread only. Whatever is sent after a pool job waits in m_encoding until the
+    //job is done, so the wire order matches the emit order.
+    void client_impl::send_encoded(encoded_packet& out)
+    {
+        if(out.job)
+        {
+            m_encoding.push_back(std::move(out.job));
+            flush_encoded();
+        }
+        else if(!m_encoding.empty())
+        {
+            shared_ptr<encode_pool::job> job = make_shared<encode_pool::job>(packet());
+            job->frames.swap(out.frames);
+            job->done = true;
+            m_encoding.push_back(job);
+        }
+        else
+        {
+            for(auto it = out.frames.begin();it!=out.frames.end();++it)
+            {
+                send_impl(it->second,it->first?frame::opcode::binary:frame::opcode::text);
+            }
+        }
+    }
+
+    //Called on an encode pool worker.
+    void client_impl::on_pool_encoded()
+    {
+        m_client.get_io_service().post(std::bind(&client_impl::flush_encoded,this));
+    }
+
+    void client_impl::flush_encoded()
+    {
+        while(!m_encoding.empty() && m_encoding.front()->done.load(std::memory_order_acquire))
+        {
+            shared_ptr<encode_pool::job> job = m_encoding.front();
+            m_encoding.pop_front();
+            for(auto it = job->frames.begin();it!=job->frames.end();++it)
+            {
+                send_impl(it->second,it->first?frame::opcode::binary:frame::opcode::text);
+            }
+        }
+    }
+
     void client_impl::remove_socket(string const& nsp)
     {
         lock_guard<mutex> guard(m_socket_mutex);
@@ -226,6 +302,12 @@ namespace sio
         if(m_socket_open_listener)m_socket_open_listener(nsp);
     }
 
+    void client_impl::drain_socket(string const& nsp)
+    {
+        socket::ptr so_ptr = get_socket_locked(nsp);
+        if(so_ptr)so_ptr->drain_outbound();
+    }
+
     /*************************private:*************************/
     void client_impl::run_loop()
     {
@@ -316,6 +398,7 @@ namespace sio
         }
         else
         {
+            flush_writes();
             lib::error_code ec;
             m_client.close(m_con, code, reason, ec);
         }
@@ -325,15 +408,83 @@ namespace sio
     {
         if(m_con_state == con_opened)
         {
-            lib::error_code ec;
-            m_client.send(m_con,*payload_ptr,opcode,ec);
-            if(ec)
+            //prepared frames skip websocketpp's check, the server would close with 1007.
+            if(opcode == frame::opcode::text && !utf8_validator::validate(*payload_ptr))
             {
-                cerr<<"Send failed,reason:"<< ec.message()<<endl;
+                cerr<<"Send failed,reason: invalid UTF-8 in text frame"<<endl;
+                return;
             }
+            frame::masking_key_type key;
+            key.i = static_cast<uint32_t>(m_mask_rng());
+            m_frame_buffer.append(*payload_ptr,opcode,key);
+            if(!m_coalesce_writes || m_frame_buffer.size() >= kMaxCoalescedBytes)
+            {
+                flush_writes();
+            }
+            else if(!m_coalesce_flush_pending)
+            {
+                m_coalesce_flush_pending = true;
+                if(m_coalesce_window_us == 0)
+                {
+                    m_client.get_io_service().post(std::bind(&client_impl::flush_writes,this));
+                }
+                else
+                {
+                    if(!m_coalesce_timer)
+                    {
+                        m_coalesce_timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(get_io_service()));
+                    }
+                    asio::error_code ec;
+                    m_coalesce_timer->expires_from_now(std::chrono::microseconds(m_coalesce_window_us),ec);
+                    m_coalesce_timer->async_wait(std::bind(&client_impl::timeout_coalesce,this,std::placeholders::_1));
+                }
+            }
+        }
+    }
+
+    //Writes every gathered frame as the payload of one prepared message with an empty header,
+    //so websocketpp puts them on the wire as is, in a single write. Without coalescing that is
+    //the one frame send_impl just built.
+    void client_impl::flush_writes()
+    {
+        m_coalesce_flush_pending = false;
+        if(m_frame_buffer.empty())
+        {
+            return;
+        }
+        if(m_con_state != con_opened)
+        {
+            m_frame_buffer.clear();
+            return;
+        }
+        client_type::message_ptr msg = lib::make_shared<client_type::message_type>(client_type::message_type::con_msg_man_ptr(),frame::opcode::binary,0);
+        m_frame_buffer.take(msg->get_raw_payload());
+        msg->set_prepared(true);
+        lib::error_code ec;
+        m_client.send(m_con,msg,ec);
+        if(ec)
+        {
+            cerr<<"Send failed,reason:"<< ec.message()<<endl;
         }
     }
 
+    void client_impl::timeout_coalesce(asio::error_code const& ec)
+    {
+        if(ec)
+        {
+            return;
+        }
+        flush_writes();
+    }
+
+    write_stats client_impl::get_write_stats() const
+    {
+        write_stats stats;
+        stats.frames = m_frame_buffer.frames();
+        stats.writes = m_frame_buffer.writes();
+        return stats;
+    }
+
     void client_impl::timeout_ping(const asio::error_code &ec)
     {
         if(ec)
@@ -404,6 +555,7 @@ namespace sio
 
         m_con.reset();
         m_con_state = con_closed;
+        m_encoding.clear();
         this->sockets_invoke_void(&sio::socket::on_disconnect);
         LOG("Connection failed." << endl);
         if(m_reconn_made<m_reconn_attempts && !m_abort_retries)
@@ -457,6 +609,7 @@ namespace sio
         
         m_con.reset();
         this->clear_timers();
+        m_encoding.clear();
         client::close_reason reason;
 
         // If we initiated the close, no matter what the close status was,
@@ -493,7 +646,7 @@ namespace sio
     void client_impl::on_message(connection_hdl, client_type::message_ptr msg)
     {
         // Parse the incoming message according to socket.IO rules
-        m_packet_mgr.put_payload(msg->get_payload());
+        m_packet_mgr.put_payload(std::move(msg->get_raw_payload()));
     }
     
     void client_impl::on_handshake(message::ptr const& message)
@@ -504,7 +657,7 @@ namespace sio
             const map<string,message::ptr>* values = &(obj_ptr->get_map());
             auto it = values->find("sid");
             if (it!= values->end()) {
-                m_sid = static_pointer_cast<string_message>(it->second)->get_string();
+                m_sid = it->second->get_string();
             }
             else
             {
@@ -512,7 +665,7 @@ namespace sio
             }
             it = values->find("pingInterval");
             if (it!= values->end()&&it->second->get_flag() == message::flag_integer) {
-                m_ping_interval = (unsigned)static_pointer_cast<int_message>(it->second)->get_int();
+                m_ping_interval = (unsigned)it->second->get_int();
             }
             else
             {
@@ -521,7 +674,7 @@ namespace sio
             it = values->find("pingTimeout");
 
             if (it!=values->end()&&it->second->get_flag() == message::flag_integer) {
-                m_ping_timeout = (unsigned) static_pointer_cast<int_message>(it->second)->get_int();
+                m_ping_timeout = (unsigned) it->second->get_int();
             }
             else
             {
@@ -542,16 +695,13 @@ failed:
     {
         // Reply with pong packet.
         packet p(packet::frame_pong);
-        m_packet_mgr.encode(p, [&](bool /*isBin*/,shared_ptr<const string> payload)
-        {
-            this->m_client.send(this->m_con, *payload, frame::opcode::text);
-        });
+        send(p);
 
         // Reset the ping timeout.
         update_ping_timeout_timer();
     }
 
-    void client_impl::on_decode(packet const& p)
+    void client_impl::on_decode(packet& p)
     {
         switch(p.get_frame())
         {
@@ -566,7 +716,7 @@ failed:
                     const std::map<std::string, message::ptr>* values = &(obj_ptr->get_map());
                     auto it = values->find("sid");
                     if (it != values->end()) {
-                        m_sid = std::static_pointer_cast<string_message>(it->second)->get_string();
+                        m_sid = it->second->get_string();
                     }
                 }
             }
@@ -590,6 +740,33 @@ failed:
         }
     }
     
+    //Lets the decoder skip events no socket would deliver to a listener, and keep events only
+    //typed handlers read as json text.
+    packet_manager::event_decode client_impl::wants_event(string const& nsp,string const& name)
+    {
+        socket::ptr so_ptr = get_socket_locked(nsp);
+        bool typed = false;
+        bool streamed = false;
+        if(!so_ptr || !so_ptr->wants_event(name,typed,streamed))
+        {
+            return packet_manager::event_drop;
+        }
+        if(streamed)
+        {
+            return packet_manager::event_stream;
+        }
+        return typed ? packet_manager::event_decode_lazy : packet_manager::event_decode_tree;
+    }
+
+    void client_impl::on_stream(packet const& header,shared_ptr<const string> const& attachment,bool last)
+    {
+        socket::ptr so_ptr = get_socket_locked(header.get_nsp());
+        if(so_ptr)
+        {
+            so_ptr->on_stream_packet(header,attachment,last);
+        }
+    }
+
     void client_impl::on_encode(bool isBinary,shared_ptr<const string> const& payload)
     {
         LOG("encoded payload length:"<<payload->length()<<endl);
@@ -605,6 +782,12 @@ failed:
             m_ping_timeout_timer->cancel(ec);
             m_ping_timeout_timer.reset();
         }
+        if(m_coalesce_timer)
+        {
+            m_coalesce_timer->cancel(ec);
+            m_coalesce_timer.reset();
+        }
+        m_coalesce_flush_pending = false;
     }
 
     void client_impl::update_ping_timeout_timer() {
@@ -622,6 +805,7 @@ failed:
         m_client.reset();
         m_sid.clear();
         m_packet_mgr.reset();
+        m_frame_buffer.clear();
     }
     
 #if SIO_TLS
@@ -39,11 +39,13 @@ typedef websocketpp::config::asio_client client_config;
 #include <asio/io_service.hpp>
 
 #include <atomic>
+#include <deque>
 #include <memory>
 #include <map>
 #include <thread>
 #include "../sio_client.h"
 #include "sio_packet.h"
+#include "sio_frame_buffer.h"
 
 namespace sio
 {
@@ -64,7 +66,7 @@ namespace sio
         
         client_impl(client_options const& options);
         
-        ~client_impl();
+        virtual ~client_impl();
         
         //set listeners and event bindings.
 #define SYNTHESIS_SETTER(__TYPE__,__FIELD__) \
@@ -118,6 +120,8 @@ namespace sio
         
         std::string const& get_sessionid() const { return m_sid; }
 
+        write_stats get_write_stats() const;
+
         void set_reconnect_attempts(unsigned attempts) {m_reconn_attempts = attempts;}
 
         void set_reconnect_delay(unsigned millis) {m_reconn_delay = millis;if(m_reconn_delay_max<millis) m_reconn_delay_max = millis;}
@@ -134,6 +138,12 @@ namespace sio
 
     protected:
         void send(packet& p);
+
+        void encode_outbound(packet& p,encoded_packet& out);
+
+        //virtual so a test client can see what a socket hands over for the wire.
+        virtual void send_encoded(encoded_packet& out);
+
         
         void remove_socket(std::string const& nsp);
         
@@ -142,6 +152,10 @@ namespace sio
         void on_socket_closed(std::string const& nsp);
         
         void on_socket_opened(std::string const& nsp);
+
+        void drain_socket(std::string const& nsp);
+
+        void on_decode(packet& pack);
         
     private:
         void run_loop();
@@ -151,6 +165,15 @@ namespace sio
         void close_impl(close::status::value const& code,std::string const& reason);
         
         void send_impl(std::shared_ptr<const std::string> const&  payload_ptr,frame::opcode::value opcode);
+
+
+        void flush_writes();
+
+        void timeout_coalesce(asio::error_code const& ec);
+
+        void on_pool_encoded();
+
+        void flush_encoded();
         
         void ping(const asio::error_code& ec);
         
@@ -164,7 +187,8 @@ namespace sio
         
         void sockets_invoke_void(void (sio::socket::*fn)(void));
         
-        void on_decode(packet const& pack);
+        packet_manager::event_decode wants_event(string const& nsp,string const& name);
+        void on_stream(packet const& header,shared_ptr<const string> const& attachment,bool last);
         void on_encode(bool isBinary,shared_ptr<const string> const& payload);
         
         //websocket callbacks
@@ -245,6 +269,31 @@ namespace sio
 
         std::atomic<bool> m_abort_retries { false };
 
+        //masking keys for outgoing frames. The same random_device backed policy websocketpp
+        //masks its own frames with, RFC 6455 asks for a strong entropy source.
+        client_config::rng_type m_mask_rng;
+
+        bool m_coalesce_writes;
+
+        unsigned m_coalesce_window_us;
+
+        //masked frames waiting for the next write, only used on the network thread.
+        frame_buffer m_frame_buffer;
+
+        bool m_coalesce_flush_pending;
+
+        std::unique_ptr<asio::steady_timer> m_coalesce_timer;
+
+        static const size_t kMaxCoalescedBytes = 64 * 1024;
+
+        size_t m_encode_threshold;
+
+        //packets sent after one that is still on the encode pool, in wire order. Network thread only.
+        std::deque<std::shared_ptr<encode_pool::job> > m_encoding;
+
+        //declared last so its workers are joined before anything they post to is destroyed.
+        std::unique_ptr<encode_pool> m_encode_pool;
+
         friend class sio::client;
         friend class sio::socket;
     };
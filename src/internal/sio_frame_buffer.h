@@ -0,0 +1,93 @@
+//
+//  sio_frame_buffer.h
+//
+//  Masked client frames built ahead of websocketpp, so they are written as is and several
+//  can share one socket write. Only used on the network thread, the counters may be read
+//  from any thread.
+//
+
+#ifndef SIO_FRAME_BUFFER_H
+#define SIO_FRAME_BUFFER_H
+
+#include <websocketpp/frame.hpp>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace sio
+{
+    class frame_buffer
+    {
+    public:
+        frame_buffer():
+            m_frames(0),
+            m_writes(0)
+        {
+        }
+
+        //Appends payload as one final frame masked with key. Masking copies the payload
+        //straight from the encoder's buffer (or the attachment's shared string) into the frame.
+        void append(std::string const& payload, websocketpp::frame::opcode::value opcode, websocketpp::frame::masking_key_type const& key)
+        {
+            websocketpp::frame::basic_header header(opcode, payload.size(), true, true);
+            websocketpp::frame::extended_header ext_header(payload.size(), key.i);
+            m_data.append(websocketpp::frame::prepare_header(header, ext_header));
+            size_t offset = m_data.size();
+            m_data.resize(offset + payload.size());
+            if(!payload.empty())
+            {
+                //word_mask_exact only reads from its input.
+                websocketpp::frame::word_mask_exact(reinterpret_cast<uint8_t*>(const_cast<char*>(payload.data())),
+                                                    reinterpret_cast<uint8_t*>(&m_data[offset]), payload.size(), key);
+            }
+            m_frames.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        //Moves every frame appended so far into out, for one write.
+        void take(std::string& out)
+        {
+            out.clear();
+            out.swap(m_data);
+            m_writes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        //Drops the frames appended so far without counting a write.
+        void clear()
+        {
+            m_data.clear();
+        }
+
+        bool empty() const
+        {
+            return m_data.empty();
+        }
+
+        size_t size() const
+        {
+            return m_data.size();
+        }
+
+        uint64_t frames() const
+        {
+            return m_frames.load(std::memory_order_relaxed);
+        }
+
+        uint64_t writes() const
+        {
+            return m_writes.load(std::memory_order_relaxed);
+        }
+
+    private:
+        //disable copy constructor and assign operator.
+        frame_buffer(frame_buffer const&);
+        void operator=(frame_buffer const&);
+
+        std::string m_data;
+
+        std::atomic<uint64_t> m_frames;
+
+        std::atomic<uint64_t> m_writes;
+    };
+}
+
+#endif // SIO_FRAME_BUFFER_H
@@ -0,0 +1,100 @@
+//
+//  sio_mpsc_queue.h
+//
+//  Unbounded multi-producer single-consumer queue (Vyukov's node based design).
+//  push never takes a lock; pop and clear must only be called from one consumer thread.
+//
+
+#ifndef SIO_MPSC_QUEUE_H
+#define SIO_MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+namespace sio
+{
+    template<typename T>
+    class mpsc_queue
+    {
+    public:
+        mpsc_queue():
+            m_tail(new node())
+        {
+            m_head.store(m_tail, std::memory_order_relaxed);
+        }
+
+        ~mpsc_queue()
+        {
+            clear();
+            delete m_tail;
+        }
+
+        void push(T&& value)
+        {
+            push_node(new node(std::move(value)));
+        }
+
+        void push(T const& value)
+        {
+            push_node(new node(value));
+        }
+
+        //Returns false if empty. An item whose push has not returned yet may not be seen.
+        bool pop(T& out)
+        {
+            node* tail = m_tail;
+            node* next = tail->next.load(std::memory_order_acquire);
+            if(!next)
+            {
+                return false;
+            }
+            //next becomes the new stub, its value is moved out and left empty.
+            out = std::move(next->value);
+            m_tail = next;
+            delete tail;
+            return true;
+        }
+
+        void clear()
+        {
+            T discard;
+            while(pop(discard))
+            {
+            }
+        }
+
+    private:
+        struct node
+        {
+            node():
+                next(nullptr)
+            {
+            }
+
+            template<typename U>
+            explicit node(U&& v):
+                next(nullptr),
+                value(std::forward<U>(v))
+            {
+            }
+
+            std::atomic<node*> next;
+            T value;
+        };
+
+        void push_node(node* n)
+        {
+            node* prev = m_head.exchange(n, std::memory_order_acq_rel);
+            prev->next.store(n, std::memory_order_release);
+        }
+
+        //disable copy constructor and assign operator.
+        mpsc_queue(mpsc_queue const&);
+        void operator=(mpsc_queue const&);
+
+        std::atomic<node*> m_head;//last pushed, shared by producers.
+        node* m_tail;//consumer only.
+    };
+}
+
+#endif // SIO_MPSC_QUEUE_H
@@ -5,186 +5,497 @@
 //
 
 #include "sio_packet.h"
-#include <rapidjson/document.h>
 #include <rapidjson/encodedstream.h>
+#include <rapidjson/memorystream.h>
 #include <rapidjson/writer.h>
+#include <rapidjson/reader.h>
 #include <cassert>
+#include <atomic>
+#include <cstring>
+#include <limits>
 
 #define kBIN_PLACE_HOLDER "_placeholder"
 
+//null, true, false and the ints from SIO_SHARED_INT_MIN to SIO_SHARED_INT_MAX are shared instances
+//unless the library is built with SIO_NO_SHARED_MESSAGES. SIO_SINGLE_THREADED_MESSAGES implies it,
+//the instances are shared by all clients.
+#ifndef SIO_SHARED_INT_MIN
+#define SIO_SHARED_INT_MIN -16
+#endif
+#ifndef SIO_SHARED_INT_MAX
+#define SIO_SHARED_INT_MAX 255
+#endif
+#if defined(SIO_SINGLE_THREADED_MESSAGES) && !defined(SIO_NO_SHARED_MESSAGES)
+#define SIO_NO_SHARED_MESSAGES
+#endif
+
 namespace sio
 {
     using namespace rapidjson;
     using namespace std;
-    void accept_message(message const& msg,Value& val, Document& doc,vector<shared_ptr<const string> >& buffers);
+    //rapidjson output stream appending to a std::string, lets the writer target reusable buffers.
+    class string_output_stream
+    {
+    public:
+        typedef char Ch;
+
+        string_output_stream():_str(NULL)
+        {
+        }
+
+        void reset(string* str)
+        {
+            _str = str;
+        }
+
+        void Put(Ch c)
+        {
+            _str->push_back(c);
+        }
+
+        void Flush()
+        {
+        }
+
+    private:
+        string* _str;
+    };
+
+    typedef Writer<string_output_stream, UTF8<>, UTF8<>, MemoryPoolAllocator<> > packet_writer;
+
+    //Scratch state reused across encodes: the writer, its level stack allocator and the json buffer.
+    class packet_encoder
+    {
+    public:
+        packet_encoder():
+            _allocator(_stack_buffer, sizeof(_stack_buffer)),
+            _writer(&_allocator)
+        {
+        }
+
+        packet_writer& begin()
+        {
+            _json.clear();
+            _stream.reset(&_json);
+            _writer.Reset(_stream);
+            return _writer;
+        }
+
+        //continues the same json buffer with another root value.
+        packet_writer& next_value()
+        {
+            _writer.Reset(_stream);
+            return _writer;
+        }
+
+        string& json()
+        {
+            return _json;
+        }
+
+    private:
+        packet_encoder(packet_encoder const&);
+        void operator=(packet_encoder const&);
+
+        uint64_t _stack_buffer[128];
+        MemoryPoolAllocator<> _allocator;
+        string _json;
+        string_output_stream _stream;
+        packet_writer _writer;
+    };
+
+    void accept_message(message const& msg, packet_writer& writer, vector<shared_ptr<const string> >& buffers);
 
-	void accept_bool_message(bool_message const& msg, Value& val)
-	{
-		val.SetBool(msg.get_bool());
-	}
+    void accept_bool_message(bool_message const& msg, packet_writer& writer)
+    {
+        writer.Bool(msg.get_bool());
+    }
 
-	void accept_null_message(Value& val)
-	{
-		val.SetNull();
-	}
+    void accept_null_message(packet_writer& writer)
+    {
+        writer.Null();
+    }
 
-    void accept_int_message(int_message const& msg, Value& val)
+    void accept_int_message(int_message const& msg, packet_writer& writer)
     {
-        val.SetInt64(msg.get_int());
+        writer.Int64(msg.get_int());
     }
 
-    void accept_double_message(double_message const& msg, Value& val)
+    void accept_double_message(double_message const& msg, packet_writer& writer)
     {
-        val.SetDouble(msg.get_double());
+        writer.Double(msg.get_double());
     }
 
-    void accept_string_message(string_message const& msg, Value& val)
+    void accept_string_message(string_message const& msg, packet_writer& writer)
     {
-        val.SetString(msg.get_string().data(),(SizeType) msg.get_string().length());
+        writer.String(msg.get_string().data(),(SizeType) msg.get_string().length());
     }
 
+    void accept_binary(shared_ptr<const string> const& data, packet_writer& writer, vector<shared_ptr<const string> >& buffers)
+    {
+        writer.StartObject();
+        writer.Key(kBIN_PLACE_HOLDER);
+        writer.Bool(true);
+        writer.Key("num");
+        writer.Int((int)buffers.size());
+        writer.EndObject();
+        buffers.push_back(data);
+    }
 
-    void accept_binary_message(binary_message const& msg,Value& val,Document& doc,vector<shared_ptr<const string> >& buffers)
+    void accept_binary_message(binary_message const& msg, packet_writer& writer, vector<shared_ptr<const string> >& buffers)
     {
-        val.SetObject();
-        Value boolVal;
-        boolVal.SetBool(true);
-        val.AddMember(kBIN_PLACE_HOLDER, boolVal, doc.GetAllocator());
-        Value numVal;
-        numVal.SetInt((int)buffers.size());
-        val.AddMember("num", numVal, doc.GetAllocator());
-        buffers.push_back(msg.get_binary());
+        accept_binary(msg.get_binary(), writer, buffers);
     }
 
-    void accept_array_message(array_message const& msg,Value& val,Document& doc,vector<shared_ptr<const string> >& buffers)
+    //Writes typed arguments into the encoder's json, each root value after a comma.
+    class typed_args_writer : public json_handler
+    {
+    public:
+        typed_args_writer(packet_encoder& encoder, vector<shared_ptr<const string> >& buffers):
+            _encoder(encoder),
+            _writer(NULL),
+            _buffers(buffers),
+            _depth(0)
+        {
+        }
+
+        bool null_value() override { return value().Null(); }
+        bool bool_value(bool b) override { return value().Bool(b); }
+        bool int_value(int64_t i) override { return value().Int64(i); }
+        bool uint_value(uint64_t u) override { return value().Uint64(u); }
+        bool double_value(double d) override { return value().Double(d); }
+        bool string_value(const char* str,size_t length) override { return value().String(str,(SizeType)length); }
+
+        bool binary_value(shared_ptr<const string> const& data) override
+        {
+            accept_binary(data, value(), _buffers);
+            return true;
+        }
+
+        bool start_object() override
+        {
+            packet_writer& writer = value();
+            ++_depth;
+            return writer.StartObject();
+        }
+
+        bool key(const char* str,size_t length) override { return _writer->Key(str,(SizeType)length); }
+
+        bool end_object() override
+        {
+            --_depth;
+            return _writer->EndObject();
+        }
+
+        bool start_array() override
+        {
+            packet_writer& writer = value();
+            ++_depth;
+            return writer.StartArray();
+        }
+
+        bool end_array() override
+        {
+            --_depth;
+            return _writer->EndArray();
+        }
+
+    private:
+        packet_writer& value()
+        {
+            if(_depth == 0)
+            {
+                _encoder.json().push_back(',');
+                _writer = &_encoder.next_value();
+            }
+            return *_writer;
+        }
+
+        packet_encoder& _encoder;
+        packet_writer* _writer;
+        vector<shared_ptr<const string> >& _buffers;
+        int _depth;
+    };
+
+    void accept_array_message(array_message const& msg, packet_writer& writer, vector<shared_ptr<const string> >& buffers)
     {
-        val.SetArray();
+        writer.StartArray();
         for (vector<message::ptr>::const_iterator it = msg.get_vector().begin(); it!=msg.get_vector().end(); ++it) {
-            Value child;
-            accept_message(*(*it), child, doc,buffers);
-            val.PushBack(child, doc.GetAllocator());
+            accept_message(*(*it), writer, buffers);
         }
+        writer.EndArray((SizeType)msg.get_vector().size());
     }
 
-    void accept_object_message(object_message const& msg,Value& val,Document& doc,vector<shared_ptr<const string> >& buffers)
+    void accept_object_message(object_message const& msg, packet_writer& writer, vector<shared_ptr<const string> >& buffers)
     {
-        val.SetObject();
+        writer.StartObject();
         for (map<string,message::ptr>::const_iterator it = msg.get_map().begin(); it!= msg.get_map().end(); ++it) {
-            Value nameVal;
-            nameVal.SetString(it->first.data(), (SizeType)it->first.length(), doc.GetAllocator());
-            Value valueVal;
-            accept_message(*(it->second), valueVal, doc,buffers);
-            val.AddMember(nameVal, valueVal, doc.GetAllocator());
+            writer.Key(it->first.data(), (SizeType)it->first.length());
+            accept_message(*(it->second), writer, buffers);
         }
+        writer.EndObject((SizeType)msg.get_map().size());
     }
 
-    void accept_message(message const& msg,Value& val, Document& doc,vector<shared_ptr<const string> >& buffers)
+    //Walks the message tree once and streams it straight into the writer, no intermediate Document.
+    void accept_message(message const& msg, packet_writer& writer, vector<shared_ptr<const string> >& buffers)
     {
         const message* msg_ptr = &msg;
         switch(msg.get_flag())
         {
         case message::flag_integer:
         {
-            accept_int_message(*(static_cast<const int_message*>(msg_ptr)), val);
+            accept_int_message(*(static_cast<const int_message*>(msg_ptr)), writer);
             break;
         }
         case message::flag_double:
         {
-            accept_double_message(*(static_cast<const double_message*>(msg_ptr)), val);
+            accept_double_message(*(static_cast<const double_message*>(msg_ptr)), writer);
             break;
         }
         case message::flag_string:
         {
-            accept_string_message(*(static_cast<const string_message*>(msg_ptr)), val);
+            accept_string_message(*(static_cast<const string_message*>(msg_ptr)), writer);
             break;
         }
 		case message::flag_boolean:
 		{
-			accept_bool_message(*(static_cast<const bool_message*>(msg_ptr)), val);
+			accept_bool_message(*(static_cast<const bool_message*>(msg_ptr)), writer);
 			break;
 		}
 		case message::flag_null:
 		{
-			accept_null_message(val);
+			accept_null_message(writer);
 			break;
 		}
         case message::flag_binary:
         {
-            accept_binary_message(*(static_cast<const binary_message*>(msg_ptr)), val,doc,buffers);
+            accept_binary_message(*(static_cast<const binary_message*>(msg_ptr)), writer, buffers);
             break;
         }
         case message::flag_array:
         {
-            accept_array_message(*(static_cast<const array_message*>(msg_ptr)), val,doc,buffers);
+            accept_array_message(*(static_cast<const array_message*>(msg_ptr)), writer, buffers);
             break;
         }
         case message::flag_object:
         {
-            accept_object_message(*(static_cast<const object_message*>(msg_ptr)), val,doc,buffers);
+            accept_object_message(*(static_cast<const object_message*>(msg_ptr)), writer, buffers);
             break;
         }
         default:
+            //keep the output well formed, the DOM path emitted null here as well.
+            writer.Null();
             break;
         }
     }
 
-    message::ptr from_json(Value const& value, vector<shared_ptr<const string> > const& buffers)
+    static const char kDIGIT_PAIRS[] =
+        "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+        "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+    //Number of decimal digits needed to print value.
+    unsigned count_digits(uint64_t value)
+    {
+        unsigned digits = 1;
+        for(;;)
+        {
+            if(value < 10) return digits;
+            if(value < 100) return digits + 1;
+            if(value < 1000) return digits + 2;
+            if(value < 10000) return digits + 3;
+            value /= 10000;
+            digits += 4;
+        }
+    }
+
+    //Writes value in decimal so that its last digit lands right before end,
+    //the caller reserves count_digits(value) chars for it.
+    void format_uint(char* end, uint64_t value)
     {
-        if(value.IsInt64())
+        while(value >= 100)
         {
-            return int_message::create(value.GetInt64());
+            unsigned idx = static_cast<unsigned>(value % 100) * 2;
+            value /= 100;
+            *--end = kDIGIT_PAIRS[idx + 1];
+            *--end = kDIGIT_PAIRS[idx];
         }
-        else if(value.IsDouble())
+        if(value >= 10)
         {
-            return double_message::create(value.GetDouble());
+            unsigned idx = static_cast<unsigned>(value) * 2;
+            *--end = kDIGIT_PAIRS[idx + 1];
+            *--end = kDIGIT_PAIRS[idx];
         }
-        else if(value.IsString())
+        else
+        {
+            *--end = static_cast<char>('0' + value);
+        }
+    }
+
+    //Builds message trees straight from reader events, no Document in between. Children wait on
+    //one value stack and are moved into their container when it closes, whose size is then
+    //known, so each vector is allocated once at its final size.
+    class message_tree_handler : public BaseReaderHandler<UTF8<>, message_tree_handler>
+    {
+    public:
+        //placeholders are left as objects when buffers is null, nodes come from arena unless it is null.
+        message_tree_handler(vector<shared_ptr<const string> >* buffers,message_arena* arena):
+            _buffers(buffers),
+            _arena(arena)
         {
-            string str(value.GetString(),value.GetStringLength());
-            return string_message::create(str);
         }
-        else if(value.IsArray())
+
+        bool Null() { return add(_arena ? null_message::create(*_arena) : null_message::create()); }
+        bool Bool(bool b) { return add(_arena ? bool_message::create(b,*_arena) : bool_message::create(b)); }
+        bool Int(int i) { return add(make_int(i)); }
+        bool Uint(unsigned u) { return add(make_int(u)); }
+        bool Int64(int64_t i) { return add(make_int(i)); }
+        bool Uint64(uint64_t u)
         {
-            message::ptr ptr = array_message::create();
-            for (SizeType i = 0; i< value.Size(); ++i) {
-                static_cast<array_message*>(ptr.get())->get_vector().push_back(from_json(value[i],buffers));
+            if(u > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+            {
+                return Double(static_cast<double>(u));
             }
-            return ptr;
+            return add(make_int(static_cast<int64_t>(u)));
+        }
+        bool Double(double d) { return add(_arena ? double_message::create(d,*_arena) : double_message::create(d)); }
+
+        bool String(const char* str,SizeType length,bool)
+        {
+            return add(_arena ? string_message::create(string(str,length),*_arena) : string_message::create(string(str,length)));
+        }
+
+        bool Key(const char* str,SizeType length,bool)
+        {
+            _keys.push_back(string(str,length));
+            return true;
         }
-        else if(value.IsObject())
+
+        bool StartObject() { return true; }
+        bool StartArray() { return true; }
+
+        bool EndArray(SizeType count)
         {
-            //binary placeholder
-            auto mem_it = value.FindMember(kBIN_PLACE_HOLDER);
-            if (mem_it!=value.MemberEnd() && mem_it->value.GetBool()) {
+            message::ptr ptr = _arena ? array_message::create(*_arena) : array_message::create();
+            vector<message::ptr>& vec = ptr->get_vector();
+            vec.reserve(count);
+            size_t first = _values.size() - count;
+            for(size_t i = first;i<_values.size();++i)
+            {
+                vec.push_back(std::move(_values[i]));
+            }
+            _values.resize(first);
+            return add(ptr);
+        }
 
-                int num = value["num"].GetInt();
-                if(num >= 0 && num < static_cast<int>(buffers.size()))
+        bool EndObject(SizeType count)
+        {
+            size_t first_value = _values.size() - count;
+            size_t first_key = _keys.size() - count;
+            message::ptr ptr;
+            if(!_buffers || !placeholder(first_key,first_value,count,ptr))
+            {
+                ptr = _arena ? object_message::create(*_arena) : object_message::create();
+                map<string,message::ptr>& obj = ptr->get_map();
+                for(size_t i = 0;i<count;++i)
                 {
-                    return binary_message::create(buffers[num]);
+                    obj[std::move(_keys[first_key + i])] = std::move(_values[first_value + i]);
                 }
-                return message::ptr();
             }
-            //real object message.
-            message::ptr ptr = object_message::create();
-            for (auto it = value.MemberBegin();it!=value.MemberEnd();++it)
+            _keys.resize(first_key);
+            _values.resize(first_value);
+            return add(ptr);
+        }
+
+        message::ptr result() const
+        {
+            return _values.size() == 1 ? _values[0] : message::ptr();
+        }
+
+    private:
+        message::ptr make_int(int64_t i)
+        {
+            return _arena ? int_message::create(i,*_arena) : int_message::create(i);
+        }
+
+        bool add(message::ptr const& msg)
+        {
+            _values.push_back(msg);
+            return true;
+        }
+
+        //{"_placeholder":true,"num":n} takes the n-th attachment out of its slot, or is null if there
+        //is no such one (or it was already taken).
+        bool placeholder(size_t first_key,size_t first_value,size_t count,message::ptr& out)
+        {
+            bool is_placeholder = false;
+            int num = -1;
+            for(size_t i = 0;i<count;++i)
             {
-                if(it->name.IsString())
+                string const& key = _keys[first_key + i];
+                message::ptr const& value = _values[first_value + i];
+                if(!value)
+                {
+                    continue;
+                }
+                if(key == kBIN_PLACE_HOLDER)
+                {
+                    is_placeholder = value->get_flag() == message::flag_boolean && value->get_bool();
+                }
+                else if(key == "num" && value->get_flag() == message::flag_integer)
                 {
-                    string key(it->name.GetString(),it->name.GetStringLength());
-                    static_cast<object_message*>(ptr.get())->get_map()[key] = from_json(it->value,buffers);
+                    num = static_cast<int>(value->get_int());
                 }
             }
-            return ptr;
+            if(!is_placeholder)
+            {
+                return false;
+            }
+            if(num >= 0 && num < static_cast<int>(_buffers->size()) && (*_buffers)[num])
+            {
+                out = _arena ? binary_message::create(std::move((*_buffers)[num]),*_arena) : binary_message::create(std::move((*_buffers)[num]));
+            }
+            return true;
         }
-		else if(value.IsBool())
-		{
-			return bool_message::create(value.GetBool());
-		}
-		else if(value.IsNull())
-		{
-			return null_message::create();
-		}
-        return message::ptr();
+
+        vector<shared_ptr<const string> >* _buffers;
+        message_arena* _arena;
+        vector<message::ptr> _values;
+        vector<string> _keys;
+    };
+
+    //Sized so the nodes of a typical frame fit one block, roughly what they take per json byte.
+    static size_t arena_block_size(size_t json_length)
+    {
+        size_t size = json_length * 16;
+        return size < 1024 ? 1024 : (size > 1024 * 1024 ? 1024 * 1024 : size);
+    }
+
+    //Malformed json decodes to a null message.
+    static message::ptr parse_json_insitu(char* json,size_t length,vector<shared_ptr<const string> >* buffers,bool arena)
+    {
+        std::unique_ptr<message_arena> nodes(arena ? new message_arena(arena_block_size(length)) : NULL);
+        message_tree_handler handler(buffers,nodes.get());
+        InsituStringStream stream(json);
+        Reader reader;
+        if(reader.Parse<kParseInsituFlag>(stream,handler).IsError())
+        {
+            return null_message::create();
+        }
+        return handler.result();
+    }
+
+    static message::ptr parse_json(const char* json,size_t length,bool arena)
+    {
+        std::unique_ptr<message_arena> nodes(arena ? new message_arena(arena_block_size(length)) : NULL);
+        vector<shared_ptr<const string> > no_buffers;
+        message_tree_handler handler(&no_buffers,nodes.get());
+        StringStream stream(json);
+        Reader reader;
+        if(reader.Parse<kParseNoFlags>(stream,handler).IsError())
+        {
+            return null_message::create();
+        }
+        return handler.result();
     }
 
     packet::packet(string const& nsp,message::ptr const& msg,int pack_id, bool isAck):
@@ -193,7 +504,10 @@ namespace sio
         _nsp(nsp),
         _pack_id(pack_id),
         _message(msg),
-        _pending_buffers(0)
+        _pending_buffers(0),
+        _pending_json_pos(0),
+        _next_buffer(0),
+        _arena_decode(false)
     {
         assert((!isAck
                 || (isAck&&pack_id>=0)));
@@ -205,16 +519,65 @@ namespace sio
         _nsp(nsp),
         _pack_id(-1),
         _message(msg),
-        _pending_buffers(0)
+        _pending_buffers(0),
+        _pending_json_pos(0),
+        _next_buffer(0),
+        _arena_decode(false)
+    {
+
+    }
+
+    packet::packet(string const& nsp,shared_ptr<const string> const& json_prefix,message::ptr const& args,int pack_id):
+        _frame(frame_message),
+        _type(type_event | type_undetermined),
+        _nsp(nsp),
+        _pack_id(pack_id),
+        _message(args),
+        _json_prefix(json_prefix),
+        _pending_buffers(0),
+        _pending_json_pos(0),
+        _next_buffer(0),
+        _arena_decode(false)
+    {
+        assert(!_message || _message->get_flag() == message::flag_array);
+    }
+
+    packet::packet(string const& nsp,shared_ptr<const string> const& json_prefix,shared_ptr<const string> const& raw_args,int pack_id):
+        _frame(frame_message),
+        _type(type_event | type_undetermined),
+        _nsp(nsp),
+        _pack_id(pack_id),
+        _json_prefix(json_prefix),
+        _raw_args(raw_args),
+        _pending_buffers(0),
+        _pending_json_pos(0),
+        _next_buffer(0),
+        _arena_decode(false)
     {
+    }
 
+    packet::packet(string const& nsp,shared_ptr<const string> const& json_prefix,shared_ptr<const json_args> const& typed_args,int pack_id):
+        _frame(frame_message),
+        _type(type_event | type_undetermined),
+        _nsp(nsp),
+        _pack_id(pack_id),
+        _json_prefix(json_prefix),
+        _typed_args(typed_args),
+        _pending_buffers(0),
+        _pending_json_pos(0),
+        _next_buffer(0),
+        _arena_decode(false)
+    {
     }
 
     packet::packet(packet::frame_type frame):
         _frame(frame),
         _type(type_undetermined),
         _pack_id(-1),
-        _pending_buffers(0)
+        _pending_buffers(0),
+        _pending_json_pos(0),
+        _next_buffer(0),
+        _arena_decode(false)
     {
 
     }
@@ -222,7 +585,10 @@ namespace sio
     packet::packet():
         _type(type_undetermined),
         _pack_id(-1),
-        _pending_buffers(0)
+        _pending_buffers(0),
+        _pending_json_pos(0),
+        _next_buffer(0),
+        _arena_decode(false)
     {
 
     }
@@ -244,18 +610,31 @@ namespace sio
     }
 
     bool packet::parse_buffer(const string &buf_payload)
+    {
+        if (_pending_buffers > 0) {
+            return parse_buffer(string(buf_payload));
+        }
+        return false;
+    }
+
+    //The attachment takes over buf_payload's storage, it is never copied.
+    bool packet::parse_buffer(string&& buf_payload)
     {
         if (_pending_buffers > 0) {
             assert(is_binary_message(buf_payload));//this is ensured by outside.
-            _buffers.push_back(std::make_shared<string>(buf_payload.data(),buf_payload.size()));
+            shared_ptr<const string> data = std::make_shared<string>(std::move(buf_payload));
+            size_t slot = _next_buffer++;
+            if (slot < _buffers.size()) {
+                _buffers[slot] = std::move(data);
+            }
+            else {
+                _buffers.push_back(std::move(data));
+            }
             _pending_buffers--;
             if (_pending_buffers == 0) {
-
-                Document doc;
-                doc.Parse<0>(_buffers.front()->data());
-                _buffers.erase(_buffers.begin());
-                _message = from_json(doc, _buffers);
+                _message = parse_json_insitu(&_pending_json[_pending_json_pos], _pending_json.size() - _pending_json_pos, &_buffers, _arena_decode);
                 _buffers.clear();
+                _pending_json.clear();
                 return false;
             }
             return true;
@@ -263,145 +642,640 @@ namespace sio
         return false;
     }
 
-    bool packet::parse(const string& payload_ptr)
+    void packet::set_arena_decode(bool arena)
     {
-        assert(!is_binary_message(payload_ptr)); //this is ensured by outside
-        _frame = (packet::frame_type) (payload_ptr[0] - '0');
-        _message.reset();
-        _pack_id = -1;
-        _buffers.clear();
-        _pending_buffers = 0;
-        size_t pos = 1;
-        if (_frame == frame_message) {
-            _type = (packet::type)(payload_ptr[pos] - '0');
-            if(_type < type_min || _type > type_max)
-            {
-                return false;
-            }
-            pos++;
-            if (_type == type_binary_event || _type == type_binary_ack) {
-                size_t score_pos = payload_ptr.find('-');
-                _pending_buffers = static_cast<unsigned>(std::stoul(payload_ptr.substr(pos, score_pos - pos)));
-                pos = score_pos+1;
-            }
+        _arena_decode = arena;
+    }
+
+    void packet::parse_without_buffers()
+    {
+        if (_pending_buffers > 0) {
+            _message = parse_json_insitu(&_pending_json[_pending_json_pos], _pending_json.size() - _pending_json_pos, NULL, _arena_decode);
+            _pending_buffers = 0;
+            _buffers.clear();
+            _pending_json.clear();
         }
+    }
 
-        size_t nsp_json_pos = payload_ptr.find_first_of("{[\"/",pos,4);
-        if(nsp_json_pos==string::npos)//no namespace and no message,the end.
+    bool packet::parse(const string& payload_ptr)
+    {
+        size_t json_pos = parse_header(payload_ptr);
+        if(json_pos == string::npos)
         {
-            _nsp = "/";
             return false;
         }
-        size_t json_pos = nsp_json_pos;
-        if(payload_ptr[nsp_json_pos] == '/')//nsp_json_pos is start of nsp
-        {
-            size_t comma_pos = payload_ptr.find_first_of(",");//end of nsp
-            if(comma_pos == string::npos)//packet end with nsp
-            {
-                _nsp = payload_ptr.substr(nsp_json_pos);
-                return false;
-            }
-            else//we have a message, maybe the message have an id.
-            {
-                _nsp = payload_ptr.substr(nsp_json_pos,comma_pos - nsp_json_pos);
-                pos = comma_pos+1;//start of the message
-                json_pos = payload_ptr.find_first_of("\"[{", pos, 3);//start of the json part of message
-                if(json_pos == string::npos)
-                {
-                    //no message,the end
-                    //assume if there's no message, there's no message id.
-                    return false;
-                }
-            }
+        if (_frame == frame_message && (_type == type_binary_event || _type == type_binary_ack)) {
+            //parse later when all buffers are arrived.
+            _pending_json.assign(payload_ptr, json_pos, string::npos);
+            _pending_json_pos = 0;
+            return true;
         }
         else
         {
-            _nsp = "/";
+            _message = parse_json(payload_ptr.data()+json_pos, payload_ptr.size()-json_pos, _arena_decode);
+            return false;
         }
+    }
 
-        if(pos<json_pos)//we've got pack id.
+    //Takes the frame and parses its json in place: strings are unescaped inside the frame
+    //rather than copied out first, leaving one copy into each string_message.
+    bool packet::parse(string&& payload,bool lazy)
+    {
+        size_t json_pos = parse_header(payload);
+        if(json_pos == string::npos)
         {
-	    std::string pack_id_str = payload_ptr.substr(pos, json_pos - pos);
-
-            if (std::all_of(pack_id_str.begin(), pack_id_str.end(), ::isdigit)) {
-                _pack_id = std::stoi(pack_id_str);
-            } 
-            else {
-                _pack_id = -1;
-            }
+            return false;
         }
         if (_frame == frame_message && (_type == type_binary_event || _type == type_binary_ack)) {
-            //parse later when all buffers are arrived.
-            _buffers.push_back(make_shared<string>(payload_ptr.data() + json_pos, payload_ptr.length() - json_pos));
+            //keep the whole frame and parse in place once all buffers are arrived.
+            _pending_json = std::move(payload);
+            _pending_json_pos = json_pos;
             return true;
         }
+        else if(lazy && _frame == frame_message && (_type == type_event || _type == type_ack) && payload[json_pos] == '[')
+        {
+            //the frame is shared by the lazy containers, each decodes its slice when first read.
+            size_t length = payload.size() - json_pos;
+            shared_ptr<const string> text = make_shared<const string>(std::move(payload));
+            _message = array_message::create_lazy(text,json_pos,length);
+            return false;
+        }
         else
         {
-            Document doc;
-            doc.Parse<0>(payload_ptr.data()+json_pos);
-            _message = from_json(doc, vector<shared_ptr<const string> >());
+            vector<shared_ptr<const string> > no_buffers;
+            _message = parse_json_insitu(&payload[json_pos], payload.size()-json_pos, &no_buffers, _arena_decode);
             return false;
         }
-
     }
 
-    bool packet::accept(string& payload_ptr, vector<shared_ptr<const string> >&buffers)
+    //Reads decimal digits from pos up to end, false if there are none or the value overflows.
+    static bool read_uint(const char* data,size_t end,size_t& pos,uint64_t& value)
     {
-        char frame_char = _frame+'0';
-        payload_ptr.append(&frame_char,1);
-        if (_frame!=frame_message) {
-            return false;
-        }
-        bool hasMessage = false;
-        Document doc;
-        if (_message) {
-            accept_message(*_message, doc, doc, buffers);
-            hasMessage = true;
-        }
-        bool hasBinary = buffers.size()>0;
-        _type = _type&(~type_undetermined);
-        if(_type == type_event)
+        size_t begin = pos;
+        value = 0;
+        while(pos < end && data[pos] >= '0' && data[pos] <= '9')
         {
-            _type = hasBinary?type_binary_event:type_event;
+            unsigned digit = static_cast<unsigned>(data[pos] - '0');
+            if(value > (std::numeric_limits<uint64_t>::max() - digit) / 10)
+            {
+                return false;
+            }
+            value = value * 10 + digit;
+            ++pos;
         }
-        else if(_type == type_ack)
+        return pos > begin;
+    }
+
+    static size_t find_any(const char* data,size_t length,size_t pos,const char* chars)
+    {
+        for(;pos < length;++pos)
         {
-            _type = hasBinary? type_binary_ack : type_ack;
-        }
-        ostringstream ss;
-        ss.precision(8);
-        ss<<_type;
-        if (hasBinary) {
-            ss<<buffers.size()<<"-";
+            if(data[pos] != '\0' && strchr(chars,data[pos]))
+            {
+                return pos;
+            }
         }
-        if(_nsp.size()>0 && _nsp!="/")
+        return string::npos;
+    }
+
+    size_t packet::read_header(const char* data,size_t length,header& out)
+    {
+        out.frame = frame_noop;
+        out.type = type_undetermined;
+        out.attachments = 0;
+        out.nsp = NULL;
+        out.nsp_length = 0;
+        out.pack_id = -1;
+        if(length == 0)
         {
-            ss<<_nsp;
-            if (hasMessage || _pack_id>=0) {
-                ss<<",";
+            return string::npos;
+        }
+        out.frame = (packet::frame_type) (data[0] - '0');
+        size_t pos = 1;
+        if (out.frame == frame_message) {
+            out.type = length > 1 ? data[1] - '0' : -1;
+            if(out.type < type_min || out.type > type_max)
+            {
+                return string::npos;
+            }
+            pos++;
+            if (out.type == type_binary_event || out.type == type_binary_ack) {
+                uint64_t attachments;
+                if(!read_uint(data,length,pos,attachments) || pos == length || data[pos] != '-' || attachments > std::numeric_limits<unsigned>::max())
+                {
+                    return string::npos;
+                }
+                out.attachments = static_cast<unsigned>(attachments);
+                pos++;
             }
         }
 
-        if(_pack_id>=0)
+        size_t json_pos = find_any(data,length,pos,"{[\"/");
+        if(json_pos==string::npos)//no namespace and no message,the end.
+        {
+            return string::npos;
+        }
+        if(data[json_pos] == '/')//json_pos is start of nsp
         {
-            ss<<_pack_id;
+            out.nsp = data + json_pos;
+            const char* comma = static_cast<const char*>(memchr(out.nsp,',',length - json_pos));//end of nsp
+            if(!comma)//packet end with nsp
+            {
+                out.nsp_length = length - json_pos;
+                return string::npos;
+            }
+            //we have a message, maybe the message have an id.
+            out.nsp_length = comma - out.nsp;
+            pos = comma - data + 1;//start of the message
+            json_pos = find_any(data,length,pos,"\"[{");//start of the json part of message
+            if(json_pos == string::npos)
+            {
+                //no message,the end
+                //assume if there's no message, there's no message id.
+                return string::npos;
+            }
         }
 
-        payload_ptr.append(ss.str());
-        if (hasMessage)
+        if(pos<json_pos)//we've got pack id.
         {
-            StringBuffer buffer;
-            Writer<StringBuffer> writer(buffer);
-            doc.Accept(writer);
-            payload_ptr.append(buffer.GetString(),buffer.GetSize());
+            uint64_t pack_id;
+            if(read_uint(data,json_pos,pos,pack_id) && pos == json_pos && pack_id <= static_cast<uint64_t>(std::numeric_limits<int>::max()))
+            {
+                out.pack_id = static_cast<int>(pack_id);
+            }
         }
-        return hasBinary;
+        return json_pos;
     }
 
-    packet::frame_type packet::get_frame() const
+    //Reads frame type, packet type, attachment count, namespace and ack id.
+    //Returns where the json starts, npos if the frame carries none.
+    size_t packet::parse_header(string const& payload_ptr)
     {
-        return _frame;
-    }
+        assert(!is_binary_message(payload_ptr)); //this is ensured by outside
+        _message.reset();
+        _buffers.clear();
+        _next_buffer = 0;
+        _pending_json.clear();
+        header h;
+        size_t json_pos = read_header(payload_ptr.data(),payload_ptr.size(),h);
+        _frame = h.frame;
+        _type = h.type;
+        _pending_buffers = h.attachments;
+        //one slot per announced attachment, a bogus count is not trusted beyond kMaxBufferSlots.
+        _buffers.resize(h.attachments < kMaxBufferSlots ? h.attachments : kMaxBufferSlots);
+        _pack_id = h.pack_id;
+        if(h.nsp)
+        {
+            _nsp.assign(h.nsp,h.nsp_length);
+        }
+        else
+        {
+            _nsp = "/";
+        }
+        return json_pos;
+    }
+
+    bool packet::accept(string& payload_ptr, vector<shared_ptr<const string> >&buffers)
+    {
+        packet_encoder encoder;
+        return accept(payload_ptr, buffers, encoder);
+    }
+
+    bool packet::accept(string& payload_ptr, vector<shared_ptr<const string> >&buffers, packet_encoder& encoder)
+    {
+        char frame_char = _frame+'0';
+        if (_frame!=frame_message) {
+            payload_ptr.append(&frame_char,1);
+            return false;
+        }
+        bool hasMessage = false;
+        packet_writer& writer = encoder.begin();
+        if (_json_prefix) {
+            //prepared event: array start and event name are already encoded, only the arguments are serialized.
+            string& json = encoder.json();
+            json.append(*_json_prefix);
+            if (_raw_args) {
+                //pre-serialized arguments are spliced in verbatim.
+                if (!_raw_args->empty()) {
+                    json.push_back(',');
+                    json.append(*_raw_args);
+                }
+            }
+            else if (_typed_args) {
+                typed_args_writer args_writer(encoder, buffers);
+                _typed_args->write(args_writer);
+            }
+            else if (_message) {
+                vector<message::ptr> const& args = _message->get_vector();
+                for (vector<message::ptr>::const_iterator it = args.begin(); it!=args.end(); ++it) {
+                    json.push_back(',');
+                    accept_message(*(*it), encoder.next_value(), buffers);
+                }
+            }
+            json.push_back(']');
+            hasMessage = true;
+        }
+        else if (_message) {
+            accept_message(*_message, writer, buffers);
+            hasMessage = true;
+        }
+        bool hasBinary = buffers.size()>0;
+        _type = _type&(~type_undetermined);
+        if(_type == type_event)
+        {
+            _type = hasBinary?type_binary_event:type_event;
+        }
+        else if(_type == type_ack)
+        {
+            _type = hasBinary? type_binary_ack : type_ack;
+        }
+
+        //size the header exactly: frame, type, [attachments '-'], [nsp [',']], [id]
+        bool hasNsp = _nsp.size()>0 && _nsp!="/";
+        bool hasNspComma = hasNsp && (hasMessage || _pack_id>=0);
+        unsigned attachment_digits = hasBinary ? count_digits(buffers.size()) : 0;
+        unsigned id_digits = _pack_id>=0 ? count_digits(static_cast<uint64_t>(_pack_id)) : 0;
+        size_t header_len = 2;
+        if(hasBinary)
+        {
+            header_len += attachment_digits + 1;
+        }
+        if(hasNsp)
+        {
+            header_len += _nsp.size() + (hasNspComma ? 1 : 0);
+        }
+        header_len += id_digits;
+
+        size_t json_len = hasMessage ? encoder.json().size() : 0;
+        size_t start = payload_ptr.size();
+        payload_ptr.reserve(start + header_len + json_len);
+        payload_ptr.resize(start + header_len);
+        char* out = &payload_ptr[start];
+        *out++ = frame_char;
+        *out++ = static_cast<char>('0' + _type);
+        if(hasBinary)
+        {
+            out += attachment_digits;
+            format_uint(out, buffers.size());
+            *out++ = '-';
+        }
+        if(hasNsp)
+        {
+            memcpy(out, _nsp.data(), _nsp.size());
+            out += _nsp.size();
+            if(hasNspComma)
+            {
+                *out++ = ',';
+            }
+        }
+        if(_pack_id>=0)
+        {
+            out += id_digits;
+            format_uint(out, static_cast<uint64_t>(_pack_id));
+        }
+        if (hasMessage)
+        {
+            payload_ptr.append(encoder.json());
+        }
+        return hasBinary;
+    }
+
+    shared_ptr<const string> packet::encode_event_prefix(string const& name)
+    {
+        shared_ptr<string> prefix = make_shared<string>(1,'[');
+        string_output_stream stream;
+        stream.reset(prefix.get());
+        Writer<string_output_stream> writer(stream);
+        writer.String(name.data(),(SizeType)name.length());
+        return prefix;
+    }
+
+    bool packet::validate_json(string const& json)
+    {
+        BaseReaderHandler<> handler;
+        StringStream stream(json.c_str());
+        Reader reader;
+        return !reader.Parse<kParseNoFlags>(stream, handler).IsError();
+    }
+
+    //Decodes the direct children of one array or object. Scalars become messages, nested
+    //containers become lazy messages over their own slice of the text and are only skipped here.
+    class lazy_level_handler : public BaseReaderHandler<UTF8<>, lazy_level_handler>
+    {
+    public:
+        lazy_level_handler(raw_json const& raw,StringStream& stream,vector<message::ptr>* vec,map<string,message::ptr>* map):
+            _raw(raw),
+            _stream(stream),
+            _vec(vec),
+            _map(map),
+            _depth(0),
+            _child_begin(0)
+        {
+        }
+
+        bool Null() { return add(null_message::create()); }
+        bool Bool(bool b) { return add(bool_message::create(b)); }
+        bool Int(int i) { return add(int_message::create(i)); }
+        bool Uint(unsigned u) { return add(int_message::create(u)); }
+        bool Int64(int64_t i) { return add(int_message::create(i)); }
+        bool Uint64(uint64_t u)
+        {
+            if(u > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+            {
+                return add(double_message::create(static_cast<double>(u)));
+            }
+            return add(int_message::create(static_cast<int64_t>(u)));
+        }
+        bool Double(double d) { return add(double_message::create(d)); }
+
+        bool String(const char* str,SizeType length,bool)
+        {
+            if(_depth != 1)
+            {
+                return true;
+            }
+            return add(string_message::create(string(str,length)));
+        }
+
+        bool Key(const char* str,SizeType length,bool)
+        {
+            if(_depth == 1)
+            {
+                _key.assign(str,length);
+            }
+            return true;
+        }
+
+        bool StartObject() { return start(); }
+        bool EndObject(SizeType) { return end(true); }
+        bool StartArray() { return start(); }
+        bool EndArray(SizeType) { return end(false); }
+
+    private:
+        bool add(message::ptr const& msg)
+        {
+            if(_depth != 1)
+            {
+                return true;
+            }
+            if(_vec)
+            {
+                _vec->push_back(msg);
+            }
+            else
+            {
+                (*_map)[std::move(_key)] = msg;
+            }
+            return true;
+        }
+
+        bool start()
+        {
+            if(++_depth == 2)
+            {
+                //the reader has just taken the opening bracket.
+                _child_begin = _stream.Tell() - 1;
+            }
+            return true;
+        }
+
+        bool end(bool object)
+        {
+            if(--_depth == 1)
+            {
+                size_t offset = _raw.offset + _child_begin;
+                size_t length = _stream.Tell() - _child_begin;
+                add(object ? object_message::create_lazy(_raw.text,offset,length) : array_message::create_lazy(_raw.text,offset,length));
+            }
+            return true;
+        }
+
+        raw_json const& _raw;
+        StringStream& _stream;
+        vector<message::ptr>* _vec;
+        map<string,message::ptr>* _map;
+        int _depth;
+        size_t _child_begin;
+        string _key;
+    };
+
+    //Malformed text leaves whatever was decoded before the error.
+    static void decode_raw_json(raw_json const& raw,vector<message::ptr>* vec,map<string,message::ptr>* map)
+    {
+        if(!raw.text)
+        {
+            return;
+        }
+        //the slice ends inside the frame, stop after the one value it holds.
+        StringStream stream(raw.text->data() + raw.offset);
+        lazy_level_handler handler(raw,stream,vec,map);
+        Reader reader;
+        reader.Parse<kParseStopWhenDoneFlag>(stream,handler);
+    }
+
+    message::ptr const* null_message::shared_instance()
+    {
+#ifdef SIO_NO_SHARED_MESSAGES
+        return nullptr;
+#else
+        static const message::ptr s_null(new null_message());
+        return &s_null;
+#endif
+    }
+
+    message::ptr const* bool_message::shared_instance(bool v)
+    {
+#ifdef SIO_NO_SHARED_MESSAGES
+        (void)v;
+        return nullptr;
+#else
+        static const message::ptr s_true(new bool_message(true));
+        static const message::ptr s_false(new bool_message(false));
+        return v ? &s_true : &s_false;
+#endif
+    }
+
+    message::ptr const* int_message::shared_instance(int64_t v)
+    {
+#ifdef SIO_NO_SHARED_MESSAGES
+        (void)v;
+        return nullptr;
+#else
+        static const vector<message::ptr> s_instances = []()
+        {
+            vector<message::ptr> instances;
+            for(int64_t i = SIO_SHARED_INT_MIN; i <= SIO_SHARED_INT_MAX; ++i)
+            {
+                instances.push_back(message::ptr(new int_message(i)));
+            }
+            return instances;
+        }();
+        if(v < SIO_SHARED_INT_MIN || v > SIO_SHARED_INT_MAX)
+        {
+            return nullptr;
+        }
+        return &s_instances[static_cast<size_t>(v - SIO_SHARED_INT_MIN)];
+#endif
+    }
+
+    void array_message::decode(raw_json const& raw,vector<message::ptr>& out)
+    {
+        decode_raw_json(raw,&out,NULL);
+    }
+
+    void object_message::decode(raw_json const& raw,map<string,message::ptr>& out)
+    {
+        decode_raw_json(raw,NULL,&out);
+    }
+
+    //Forwards rapidjson reader events to a json_handler.
+    class json_handler_adapter : public BaseReaderHandler<UTF8<>, json_handler_adapter>
+    {
+    public:
+        explicit json_handler_adapter(json_handler& handler):
+            _handler(handler)
+        {
+        }
+
+        bool Null() { return _handler.null_value(); }
+        bool Bool(bool b) { return _handler.bool_value(b); }
+        bool Int(int i) { return _handler.int_value(i); }
+        bool Uint(unsigned u) { return _handler.int_value(u); }
+        bool Int64(int64_t i) { return _handler.int_value(i); }
+        bool Uint64(uint64_t u)
+        {
+            if(u > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+            {
+                return _handler.uint_value(u);
+            }
+            return _handler.int_value(static_cast<int64_t>(u));
+        }
+        bool Double(double d) { return _handler.double_value(d); }
+        bool String(const char* str,SizeType length,bool) { return _handler.string_value(str,length); }
+        bool Key(const char* str,SizeType length,bool) { return _handler.key(str,length); }
+        bool StartObject() { return _handler.start_object(); }
+        bool EndObject(SizeType) { return _handler.end_object(); }
+        bool StartArray() { return _handler.start_array(); }
+        bool EndArray(SizeType) { return _handler.end_array(); }
+
+    private:
+        json_handler& _handler;
+    };
+
+    static bool visit_tree(message const& msg,json_handler& handler)
+    {
+        switch(msg.get_flag())
+        {
+            case message::flag_integer:
+                return handler.int_value(msg.get_int());
+            case message::flag_double:
+                return handler.double_value(msg.get_double());
+            case message::flag_string:
+            {
+                string const& str = msg.get_string();
+                return handler.string_value(str.data(),str.size());
+            }
+            case message::flag_binary:
+                return handler.binary_value(msg.get_binary());
+            case message::flag_boolean:
+                return handler.bool_value(msg.get_bool());
+            case message::flag_null:
+                return handler.null_value();
+            case message::flag_array:
+            case message::flag_object:
+            {
+                raw_json const* raw = msg.get_pending_json();
+                if(raw && raw->text)
+                {
+                    //still backed by json text, read the slice instead of materializing children.
+                    MemoryStream stream(raw->text->data() + raw->offset,raw->length);
+                    json_handler_adapter adapter(handler);
+                    Reader reader;
+                    return !reader.Parse<kParseStopWhenDoneFlag>(stream,adapter).IsError();
+                }
+                if(msg.get_flag() == message::flag_array)
+                {
+                    if(!handler.start_array())
+                    {
+                        return false;
+                    }
+                    for(auto it = msg.get_vector().begin();it!=msg.get_vector().end();++it)
+                    {
+                        if(!visit_message(*it,handler))
+                        {
+                            return false;
+                        }
+                    }
+                    return handler.end_array();
+                }
+                if(!handler.start_object())
+                {
+                    return false;
+                }
+                for(auto it = msg.get_map().begin();it!=msg.get_map().end();++it)
+                {
+                    if(!handler.key(it->first.data(),it->first.size()) || !visit_message(it->second,handler))
+                    {
+                        return false;
+                    }
+                }
+                return handler.end_object();
+            }
+        }
+        return false;
+    }
+
+    bool visit_message(message::ptr const& msg,json_handler& handler)
+    {
+        if(!msg)
+        {
+            return handler.null_value();
+        }
+        return visit_tree(*msg,handler);
+    }
+
+    bool packet::peek_event(string const& payload_ptr,string& nsp,string& name,int& pack_id,unsigned& attachments)
+    {
+        if(payload_ptr.size() < 2 || payload_ptr[0] != '0' + frame_message)
+        {
+            return false;
+        }
+        header h;
+        size_t json_pos = read_header(payload_ptr.data(),payload_ptr.size(),h);
+        if(json_pos == string::npos || (h.type != type_event && h.type != type_binary_event) || payload_ptr[json_pos] != '[')
+        {
+            return false;
+        }
+        size_t name_pos = payload_ptr.find_first_not_of(" \t\r\n",json_pos + 1);
+        if(name_pos == string::npos || payload_ptr[name_pos] != '"')
+        {
+            return false;
+        }
+        ++name_pos;
+        size_t name_end = payload_ptr.find_first_of("\"\\",name_pos);
+        if(name_end == string::npos || payload_ptr[name_end] != '"')
+        {
+            //escaped names are left to the full decode.
+            return false;
+        }
+        if(h.nsp)
+        {
+            nsp.assign(h.nsp,h.nsp_length);
+        }
+        else
+        {
+            nsp = "/";
+        }
+        name.assign(payload_ptr,name_pos,name_end - name_pos);
+        pack_id = h.pack_id;
+        attachments = h.attachments;
+        return true;
+    }
+
+    packet::frame_type packet::get_frame() const
+    {
+        return _frame;
+    }
 
     packet::type packet::get_type() const
     {
@@ -419,13 +1293,116 @@ namespace sio
         return _message;
     }
 
+    message::ptr packet::release_message()
+    {
+        message::ptr msg;
+        msg.swap(_message);
+        return msg;
+    }
+
     unsigned packet::get_pack_id() const
     {
         return _pack_id;
     }
 
+    //Charges msg's approximate json length against budget, false once it runs out.
+    static bool consume_budget(message const& msg,size_t& budget)
+    {
+        size_t cost = 8;//numbers, booleans, null and binary placeholders.
+        switch(msg.get_flag())
+        {
+        case message::flag_string:
+            cost = msg.get_string().size() + 2;
+            break;
+        case message::flag_array:
+        {
+            cost = 2;
+            if(cost > budget)
+            {
+                return false;
+            }
+            budget -= cost;
+            auto const& vec = msg.get_vector();
+            for(auto it = vec.begin();it!=vec.end();++it)
+            {
+                if(*it && !consume_budget(**it,budget))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case message::flag_object:
+        {
+            cost = 2;
+            if(cost > budget)
+            {
+                return false;
+            }
+            budget -= cost;
+            auto const& map = msg.get_map();
+            for(auto it = map.begin();it!=map.end();++it)
+            {
+                cost = it->first.size() + 4;
+                if(cost > budget)
+                {
+                    return false;
+                }
+                budget -= cost;
+                if(it->second && !consume_budget(*it->second,budget))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            break;
+        }
+        if(cost > budget)
+        {
+            return false;
+        }
+        budget -= cost;
+        return true;
+    }
+
+    bool packet::is_larger_than(size_t bytes) const
+    {
+        size_t budget = bytes;
+        if(_json_prefix)
+        {
+            if(_json_prefix->size() > budget)
+            {
+                return true;
+            }
+            budget -= _json_prefix->size();
+        }
+        if(_raw_args)
+        {
+            return _raw_args->size() > budget;
+        }
+        if(_typed_args)
+        {
+            return false;//not estimated, always encoded inline.
+        }
+        return _message && !consume_budget(*_message,budget);
+    }
+
+
+    packet_manager::packet_manager():
+        m_lazy_decode(false),
+        m_arena_decode(false),
+        m_discard_buffers(0),
+        m_stream_buffers(0)
+    {
+    }
+
+    packet_manager::~packet_manager()
+    {
+    }
 
-    void packet_manager::set_decode_callback(function<void (packet const&)> const& decode_callback)
+    void packet_manager::set_decode_callback(decode_callback_function const& decode_callback)
     {
         m_decode_callback = decode_callback;
     }
@@ -435,21 +1412,121 @@ namespace sio
         m_encode_callback = encode_callback;
     }
 
+    void packet_manager::set_lazy_decode(bool lazy)
+    {
+        m_lazy_decode = lazy;
+    }
+
+    void packet_manager::set_arena_decode(bool arena)
+    {
+        m_arena_decode = arena;
+    }
+
+    void packet_manager::set_event_filter(event_filter_function const& filter)
+    {
+        m_event_filter = filter;
+    }
+
+    void packet_manager::set_stream_callback(stream_callback_function const& stream_callback)
+    {
+        m_stream_callback = stream_callback;
+    }
+
+    //Drops events nobody listens to. Events asking for an ack are always decoded, the ack
+    //is still owed.
+    packet_manager::event_decode packet_manager::filter_event(string const& payload)
+    {
+        string nsp,name;
+        int pack_id;
+        unsigned attachments;
+        if(!m_event_filter || !packet::peek_event(payload,nsp,name,pack_id,attachments))
+        {
+            return event_decode_tree;
+        }
+        event_decode decision = m_event_filter(nsp,name);
+        if(decision == event_drop)
+        {
+            if(pack_id >= 0)
+            {
+                return event_decode_tree;
+            }
+            m_discard_buffers = attachments;
+        }
+        else if(decision == event_stream)
+        {
+            if(attachments == 0 || !m_stream_callback)
+            {
+                return event_decode_tree;
+            }
+            m_stream_buffers = attachments;
+        }
+        return decision;
+    }
+
     void packet_manager::reset()
     {
         m_partial_packet.reset();
+        m_discard_buffers = 0;
+        m_stream_buffers = 0;
     }
 
+    //Scratch state of one encoding thread. Emitting threads and encode_pool workers each
+    //write into their own, so encodes run in parallel without taking a lock.
+    struct encode_scratch
+    {
+        static const size_t kPayloadPoolSize = 16;
+
+        static const size_t kMaxPooledPayloadCapacity = 64 * 1024;
+
+        packet_encoder encoder;
+
+        vector<shared_ptr<string> > payload_pool;
+
+        //Hands out a pooled payload string nobody else references any more,
+        //i.e. one whose previous frame websocketpp has finished sending.
+        shared_ptr<string> acquire_payload()
+        {
+            for(auto it = payload_pool.begin();it!=payload_pool.end();++it)
+            {
+                if(it->use_count() == 1)
+                {
+                    //pairs with the release of the last other owner.
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if((*it)->capacity() > kMaxPooledPayloadCapacity)
+                    {
+                        string().swap(**it);
+                    }
+                    (*it)->clear();
+                    return *it;
+                }
+            }
+            shared_ptr<string> ptr = make_shared<string>();
+            if(payload_pool.size() < kPayloadPoolSize)
+            {
+                payload_pool.push_back(ptr);
+            }
+            return ptr;
+        }
+
+        static encode_scratch& current()
+        {
+            static thread_local encode_scratch scratch;
+            return scratch;
+        }
+    };
+
     void packet_manager::encode(packet& pack,encode_callback_function const& override_encode_callback) const
     {
-        shared_ptr<string> ptr = make_shared<string>();
+        encode_scratch& scratch = encode_scratch::current();
+        shared_ptr<string> ptr = scratch.acquire_payload();
         vector<shared_ptr<const string> > buffers;
+        bool hasBinary = pack.accept(*ptr,buffers,scratch.encoder);
         const encode_callback_function *cb_ptr = &m_encode_callback;
         if(override_encode_callback)
         {
             cb_ptr = &override_encode_callback;
         }
-        if(pack.accept(*ptr,buffers))
+        if(hasBinary)
         {
             if((*cb_ptr))
             {
@@ -472,15 +1549,111 @@ namespace sio
         }
     }
 
+    encode_pool::job::job(packet&& p):
+        pack(std::move(p)),
+        done(false)
+    {
+    }
+
+    encode_pool::encode_pool(unsigned threads):
+        m_stopping(false)
+    {
+        for(unsigned i = 0;i<threads;++i)
+        {
+            m_threads.push_back(std::thread(std::bind(&encode_pool::run,this)));
+        }
+    }
+
+    encode_pool::~encode_pool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_stopping = true;
+        }
+        m_cond.notify_all();
+        for(auto it = m_threads.begin();it!=m_threads.end();++it)
+        {
+            it->join();
+        }
+    }
+
+    void encode_pool::submit(shared_ptr<job> const& j,function<void ()> const& on_done)
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_jobs.push(make_pair(j,on_done));
+        }
+        m_cond.notify_one();
+    }
+
+    void encode_pool::run()
+    {
+        packet_manager manager;
+        while(true)
+        {
+            pair<shared_ptr<job>,function<void ()> > next;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock,[this](){ return m_stopping || !m_jobs.empty(); });
+                if(m_stopping)
+                {
+                    return;
+                }
+                next = std::move(m_jobs.front());
+                m_jobs.pop();
+            }
+            vector<packet_manager::encoded_frame>& frames = next.first->frames;
+            manager.encode(next.first->pack,[&frames](bool isBinary,shared_ptr<const string> const& payload)
+            {
+                frames.push_back(packet_manager::encoded_frame(isBinary,payload));
+            });
+            next.first->done.store(true,std::memory_order_release);
+            if(next.second)
+            {
+                next.second();
+            }
+        }
+    }
+
     void packet_manager::put_payload(string const& payload)
+    {
+        put_payload(string(payload));
+    }
+
+    void packet_manager::put_payload(string&& payload)
     {
         unique_ptr<packet> p;
         do
         {
             if(packet::is_text_message(payload))
             {
+                m_discard_buffers = 0;
+                if(m_stream_buffers > 0)
+                {
+                    //the streamed event was cut short, forget its header.
+                    m_stream_buffers = 0;
+                    if(m_partial_packet)
+                    {
+                        m_stream_callback(*m_partial_packet,shared_ptr<const string>(),true);
+                        m_partial_packet.reset();
+                    }
+                }
+                event_decode decision = filter_event(payload);
+                if(decision == event_drop)
+                {
+                    return;
+                }
                 p.reset(new packet());
-                if(p->parse(payload))
+                p->set_arena_decode(m_arena_decode);
+                if(decision == event_stream)
+                {
+                    p->parse(std::move(payload));
+                    p->parse_without_buffers();
+                    m_partial_packet = std::move(p);
+                    m_stream_callback(*m_partial_packet,shared_ptr<const string>(),false);
+                    return;
+                }
+                if(p->parse(std::move(payload),m_lazy_decode || decision == event_decode_lazy))
                 {
                     m_partial_packet = std::move(p);
                 }
@@ -491,9 +1664,28 @@ namespace sio
             }
             else if(packet::is_binary_message(payload))
             {
+                if(m_discard_buffers > 0)
+                {
+                    //attachment of a dropped event, never buffered.
+                    m_discard_buffers--;
+                    return;
+                }
+                if(m_stream_buffers > 0 && m_partial_packet)
+                {
+                    //handed out right away, only this one attachment is held.
+                    m_stream_buffers--;
+                    bool last = m_stream_buffers == 0;
+                    shared_ptr<const string> attachment = std::make_shared<string>(std::move(payload));
+                    m_stream_callback(*m_partial_packet,attachment,last);
+                    if(last)
+                    {
+                        m_partial_packet.reset();
+                    }
+                    return;
+                }
                 if(m_partial_packet)
                 {
-                    if(!m_partial_packet->parse_buffer(payload))
+                    if(!m_partial_packet->parse_buffer(std::move(payload)))
                     {
                         p = std::move(m_partial_packet);
                         break;
@@ -503,7 +1695,7 @@ namespace sio
             else
             {
                 p.reset(new packet());
-                p->parse(payload);
+                p->parse(std::move(payload));
                 break;
             }
             return;
@@ -8,11 +8,20 @@
 #define SIO_PACKET_H
 #include <sstream>
 #include "../sio_message.h"
+#include "../sio_typed.h"
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
 
 namespace sio
 {
     using namespace std;
+
+    class packet_encoder;
     
     class packet
     {
@@ -41,17 +50,43 @@ namespace sio
             type_max = 6,
             type_undetermined = 0x10 //undetermined mask bit
         };
+
+        //fields of a text frame's header, nsp points into the frame.
+        struct header
+        {
+            frame_type frame;
+            int type;
+            unsigned attachments;
+            const char* nsp;//null when the frame names no namespace.
+            size_t nsp_length;
+            int pack_id;
+        };
     private:
         frame_type _frame;
         int _type;
         string _nsp;
         int _pack_id;
         message::ptr _message;
+        shared_ptr<const string> _json_prefix;
+        shared_ptr<const string> _raw_args;
+        shared_ptr<const json_args> _typed_args;
         unsigned _pending_buffers;
-        vector<shared_ptr<const string> > _buffers;
+        size_t _pending_json_pos;
+        string _pending_json;//frame of a binary packet waiting for its buffers, json starts at _pending_json_pos.
+        vector<shared_ptr<const string> > _buffers;//one slot per attachment, placeholders move out of them.
+        size_t _next_buffer;
+        bool _arena_decode;
+        static const size_t kMaxBufferSlots = 1024;
+        size_t parse_header(string const& payload_ptr);
     public:
         packet(string const& nsp,message::ptr const& msg,int pack_id = -1,bool isAck = false);//message type constructor.
         
+        packet(string const& nsp,shared_ptr<const string> const& json_prefix,message::ptr const& args,int pack_id = -1);//prepared event constructor, args is an array message.
+
+        packet(string const& nsp,shared_ptr<const string> const& json_prefix,shared_ptr<const string> const& raw_args,int pack_id = -1);//pre-serialized arguments constructor.
+
+        packet(string const& nsp,shared_ptr<const string> const& json_prefix,shared_ptr<const json_args> const& typed_args,int pack_id = -1);//typed arguments constructor, written when encoded.
+
         packet(frame_type frame);
         
         packet(type type,string const& nsp= string(),message::ptr const& msg = message::ptr());//other message types constructor.
@@ -63,17 +98,42 @@ namespace sio
         type get_type() const;
         
         bool parse(string const& payload_ptr);//return true if need to parse buffer.
+
+        bool parse(string&& payload,bool lazy = false);//same, parses the json inside payload in place. lazy events decode on first access.
         
         bool parse_buffer(string const& buf_payload);
+
+        bool parse_buffer(string&& buf_payload);//takes the frame as the attachment's storage.
+
+        void parse_without_buffers();//decodes a binary packet's json now, placeholders stay {"_placeholder":true,"num":n} objects.
+
+        void set_arena_decode(bool arena);//decoded trees take their nodes from one message_arena per packet.
         
         bool accept(string& payload_ptr, vector<shared_ptr<const string> >&buffers); //return true if has binary buffers.
+
+        bool accept(string& payload_ptr, vector<shared_ptr<const string> >&buffers, packet_encoder& encoder); //reuses the encoder's scratch state.
         
         string const& get_nsp() const;
         
         message::ptr const& get_message() const;
+
+        message::ptr release_message();//hands the message over, the packet is left without one.
         
         unsigned get_pack_id() const;
+
+        bool is_larger_than(size_t bytes) const;//rough estimate of the encoded json size, stops early.
         
+        static shared_ptr<const string> encode_event_prefix(string const& name);//returns the json array start for an event, ["name"
+
+        static bool validate_json(string const& json);//true if json is exactly one well formed value.
+
+        //reads namespace, event name, ack id and attachment count of an event frame without decoding
+        //its arguments. False if it is not an event or the name is not a plain string.
+        static bool peek_event(string const& payload_ptr,string& nsp,string& name,int& pack_id,unsigned& attachments);
+
+        //parses the header without allocating, returns where the json starts, npos if there is none or the header is malformed.
+        static size_t read_header(const char* data,size_t length,header& out);
+
         static bool is_message(string const& payload_ptr);
         static bool is_text_message(string const& payload_ptr);
         static bool is_binary_message(string const& payload_ptr);
@@ -83,15 +143,45 @@ namespace sio
     {
     public:
         typedef function<void (bool,shared_ptr<const string> const&)> encode_callback_function;
-        typedef  function<void (packet const&)> decode_callback_function;
+        typedef  function<void (packet&)> decode_callback_function;//the packet is dropped afterwards, its message may be taken.
+
+        enum event_decode
+        {
+            event_drop,
+            event_decode_tree,
+            event_decode_lazy,//only read through sio_typed.h, kept as json text.
+            event_stream//binary event handed out attachment by attachment.
+        };
+
+        //called with a null attachment once the json of a streamed event is decoded, then once per attachment.
+        //A null attachment with last set means the event was cut short by a new text frame.
+        typedef function<void (packet const& header,shared_ptr<const string> const& attachment,bool last)> stream_callback_function;
+
+        typedef function<event_decode (string const& nsp,string const& name)> event_filter_function;
+
+        typedef pair<bool,shared_ptr<const string> > encoded_frame;//is binary, payload
+
+        packet_manager();
+
+        ~packet_manager();
         
         void set_decode_callback(decode_callback_function const& decode_callback);
 
         void set_encode_callback(encode_callback_function const& encode_callback);
+
+        void set_lazy_decode(bool lazy);
+
+        void set_arena_decode(bool arena);
+
+        void set_event_filter(event_filter_function const& filter);
+
+        void set_stream_callback(stream_callback_function const& stream_callback);
         
         void encode(packet& pack,encode_callback_function const& override_encode_callback = encode_callback_function()) const;
         
         void put_payload(string const& payload);
+
+        void put_payload(string&& payload);
         
         void reset();
         
@@ -101,6 +191,64 @@ namespace sio
         encode_callback_function m_encode_callback;
         
         std::unique_ptr<packet> m_partial_packet;
+
+        bool m_lazy_decode;
+
+        bool m_arena_decode;
+
+        event_filter_function m_event_filter;
+
+        //attachments still to come for a dropped binary event.
+        unsigned m_discard_buffers;
+
+        stream_callback_function m_stream_callback;
+
+        //attachments still to come for the streamed event in m_partial_packet.
+        unsigned m_stream_buffers;
+
+        event_decode filter_event(string const& payload);
+    };
+
+    //Worker threads for encoding large packets off the network thread.
+    class encode_pool
+    {
+    public:
+        struct job
+        {
+            explicit job(packet&& p);
+
+            packet pack;
+            vector<packet_manager::encoded_frame> frames;
+            std::atomic<bool> done;
+        };
+
+        explicit encode_pool(unsigned threads);
+
+        ~encode_pool();
+
+        //on_done runs on the worker thread after job's frames are filled in and done is set.
+        void submit(shared_ptr<job> const& j,function<void ()> const& on_done);
+
+    private:
+        void run();
+
+        std::mutex m_mutex;
+
+        std::condition_variable m_cond;
+
+        std::queue<pair<shared_ptr<job>,function<void ()> > > m_jobs;
+
+        bool m_stopping;
+
+        vector<std::thread> m_threads;
+    };
+
+    //A packet encoded on the emitting thread and queued for the network thread. A large
+    //packet handed to the encode pool has no frames yet, job fills them in.
+    struct encoded_packet
+    {
+        vector<packet_manager::encoded_frame> frames;
+        shared_ptr<encode_pool::job> job;
     };
 }
 #endif
@@ -132,6 +132,11 @@ namespace sio
         return m_impl->get_sessionid();
     }
 
+    write_stats client::get_write_stats() const
+    {
+        return m_impl->get_write_stats();
+    }
+
     void client::set_reconnect_attempts(int attempts)
     {
         m_impl->set_reconnect_attempts(attempts);
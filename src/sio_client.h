@@ -6,6 +6,7 @@
 
 #ifndef SIO_CLIENT_H
 #define SIO_CLIENT_H
+#include <cstdint>
 #include <string>
 #include <functional>
 #include "sio_message.h"
@@ -21,6 +22,26 @@ namespace sio
 
     struct client_options {
         asio::io_context* io_context = nullptr;
+        //gather frames sent in the same io_service turn into a single socket write.
+        bool coalesce_writes = false;
+        //when non zero, keep gathering for this many microseconds before writing.
+        unsigned coalesce_window_us = 0;
+        //when non zero, events larger than encode_threshold bytes are encoded on this many
+        //worker threads instead of the emitting thread. Emit order on the wire is kept.
+        //Such events are read after emit returns, do not modify their messages afterwards.
+        unsigned encode_threads = 0;
+        size_t encode_threshold = 64 * 1024;
+        //deliver non binary events and acks backed by their json text, arrays and objects are
+        //decoded when first accessed. See message::get_raw_json.
+        bool lazy_messages = false;
+        //allocate the messages of each received event from one block instead of one heap
+        //allocation per value. See message_arena.
+        bool arena_messages = false;
+    };
+
+    struct write_stats {
+        uint64_t frames = 0;
+        uint64_t writes = 0;
     };
     
     class client {
@@ -101,6 +122,9 @@ namespace sio
         bool opened() const;
         
         std::string const& get_sessionid() const;
+
+        //frames handed to the transport versus socket writes issued, see client_options::coalesce_writes.
+        write_stats get_write_stats() const;
         
     private:
         //disable copy constructor and assign operator.
@@ -10,10 +10,299 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <new>
 #include <type_traits>
+#include <utility>
+
 namespace sio
 {
+    //Bump allocator for the nodes of one message tree, see client_options::arena_messages.
+    //Copies share the same arena. Its blocks are freed once the last copy and the last node
+    //allocated from it are gone. Allocating is not synchronized.
+    class message_arena
+    {
+    public:
+        explicit message_arena(size_t block_size = 4096)
+            :m_state(new state(block_size))
+        {
+        }
+
+        message_arena(message_arena const& other)
+            :m_state(other.m_state)
+        {
+            if(m_state)
+            {
+                m_state->refs.fetch_add(1,std::memory_order_relaxed);
+            }
+        }
+
+        message_arena& operator=(message_arena const& other)
+        {
+            if(other.m_state)
+            {
+                other.m_state->refs.fetch_add(1,std::memory_order_relaxed);
+            }
+            release();
+            m_state = other.m_state;
+            return *this;
+        }
+
+        ~message_arena()
+        {
+            release();
+        }
+
+        void* allocate(size_t size)
+        {
+            size = (size + kAlign - 1) & ~(kAlign - 1);
+            if(size > m_state->remaining)
+            {
+                m_state->grow(size);
+            }
+            void* p = m_state->cursor;
+            m_state->cursor += size;
+            m_state->remaining -= size;
+            return p;
+        }
+
+        bool operator==(message_arena const& other) const
+        {
+            return m_state == other.m_state;
+        }
+
+    private:
+        static const size_t kAlign = 16;
+
+        struct no_arena
+        {
+        };
+
+        //what a message created on the heap holds.
+        explicit message_arena(no_arena)
+            :m_state(NULL)
+        {
+        }
+
+        struct block
+        {
+            block* next;
+        };
+
+        struct state
+        {
+            explicit state(size_t size)
+                :refs(1),block_size(size),cursor(NULL),remaining(0),blocks(NULL)
+            {
+            }
+
+            ~state()
+            {
+                while(blocks)
+                {
+                    block* next = blocks->next;
+                    ::operator delete(blocks);
+                    blocks = next;
+                }
+            }
+
+            void grow(size_t size)
+            {
+                size_t capacity = size > block_size ? size : block_size;
+                const size_t header = (sizeof(block) + kAlign - 1) & ~(kAlign - 1);
+                block* b = static_cast<block*>(::operator new(header + capacity));
+                b->next = blocks;
+                blocks = b;
+                cursor = reinterpret_cast<char*>(b) + header;
+                remaining = capacity;
+            }
+
+            std::atomic<size_t> refs;
+            size_t block_size;
+            char* cursor;
+            size_t remaining;
+            block* blocks;
+        };
+
+        void release()
+        {
+            if(m_state && m_state->refs.fetch_sub(1,std::memory_order_acq_rel) == 1)
+            {
+                delete m_state;
+            }
+        }
+
+        state* m_state;
+
+        friend class message;
+    };
+
+    //Lets std::allocate_shared place a node and its control block in a message_arena.
+    template<typename T>
+    class arena_allocator
+    {
+    public:
+        typedef T value_type;
+
+        explicit arena_allocator(message_arena const& arena)
+            :m_arena(arena)
+        {
+        }
+
+        template<typename U>
+        arena_allocator(arena_allocator<U> const& other)
+            :m_arena(other.m_arena)
+        {
+        }
+
+        T* allocate(size_t n)
+        {
+            return static_cast<T*>(m_arena.allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T*,size_t)
+        {
+            //given back with the whole arena.
+        }
+
+        template<typename U,typename... Args>
+        void construct(U* p,Args&&... args)
+        {
+            ::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+        }
+
+        template<typename U>
+        void destroy(U* p)
+        {
+            p->~U();
+        }
+
+        template<typename U>
+        struct rebind
+        {
+            typedef arena_allocator<U> other;
+        };
+
+        template<typename U>
+        bool operator==(arena_allocator<U> const& other) const
+        {
+            return m_arena == other.m_arena;
+        }
+
+        template<typename U>
+        bool operator!=(arena_allocator<U> const& other) const
+        {
+            return !(m_arena == other.m_arena);
+        }
+
+    private:
+        message_arena m_arena;
+
+        template<typename U> friend class arena_allocator;
+    };
+
+    class message;
+
+    struct raw_json;
+
+#ifdef SIO_INTRUSIVE_MESSAGE_PTR
+    //message::ptr when built with SIO_INTRUSIVE_MESSAGE_PTR. The count is kept in the message
+    //itself instead of a separate control block, it is not atomic with SIO_SINGLE_THREADED_MESSAGES.
+    //Offers the subset of std::shared_ptr used with messages.
+    class message_ptr
+    {
+    public:
+        message_ptr():m_p(NULL)
+        {
+        }
+
+        message_ptr(std::nullptr_t):m_p(NULL)
+        {
+        }
+
+        explicit message_ptr(message* p);
+
+        message_ptr(message_ptr const& other);
+
+        message_ptr(message_ptr&& other):m_p(other.m_p)
+        {
+            other.m_p = NULL;
+        }
+
+        ~message_ptr();
+
+        message_ptr& operator=(message_ptr const& other)
+        {
+            message_ptr(other).swap(*this);
+            return *this;
+        }
+
+        message_ptr& operator=(message_ptr&& other)
+        {
+            message_ptr(std::move(other)).swap(*this);
+            return *this;
+        }
+
+        message_ptr& operator=(std::nullptr_t)
+        {
+            reset();
+            return *this;
+        }
+
+        void reset()
+        {
+            message_ptr().swap(*this);
+        }
+
+        void reset(message* p)
+        {
+            message_ptr(p).swap(*this);
+        }
+
+        void swap(message_ptr& other)
+        {
+            message* p = m_p;
+            m_p = other.m_p;
+            other.m_p = p;
+        }
+
+        message* get() const
+        {
+            return m_p;
+        }
+
+        message& operator*() const
+        {
+            return *m_p;
+        }
+
+        message* operator->() const
+        {
+            return m_p;
+        }
+
+        explicit operator bool() const
+        {
+            return m_p != NULL;
+        }
+
+        long use_count() const;
+
+    private:
+        message* m_p;
+    };
+
+    inline bool operator==(message_ptr const& a,message_ptr const& b) { return a.get() == b.get(); }
+    inline bool operator!=(message_ptr const& a,message_ptr const& b) { return a.get() != b.get(); }
+    inline bool operator==(message_ptr const& a,std::nullptr_t) { return !a; }
+    inline bool operator==(std::nullptr_t,message_ptr const& a) { return !a; }
+    inline bool operator!=(message_ptr const& a,std::nullptr_t) { return static_cast<bool>(a); }
+    inline bool operator!=(std::nullptr_t,message_ptr const& a) { return static_cast<bool>(a); }
+#endif
+
     class message
     {
     public:
@@ -38,7 +327,11 @@ namespace sio
             return _flag;
         }
 
+#ifdef SIO_INTRUSIVE_MESSAGE_PTR
+        typedef message_ptr ptr;
+#else
         typedef std::shared_ptr<message> ptr;
+#endif
 
         virtual bool get_bool() const
         {
@@ -105,11 +398,136 @@ namespace sio
             s_empty_map.clear();
             return s_empty_map;
         }
+
+        //json text an array or object was received as when decoded lazily
+        //(client_options::lazy_messages), empty otherwise. Later changes are not reflected.
+        virtual std::string get_raw_json() const
+        {
+            return std::string();
+        }
+
+        //the json text a lazily decoded container still reads its children from,
+        //null once they are decoded and may have been changed.
+        virtual raw_json const* get_pending_json() const
+        {
+            return nullptr;
+        }
     private:
         flag _flag;
 
+#ifdef SIO_INTRUSIVE_MESSAGE_PTR
+#ifdef SIO_SINGLE_THREADED_MESSAGES
+        size_t _refs;
+
+        void add_ref()
+        {
+            ++_refs;
+        }
+
+        bool release_ref()
+        {
+            return --_refs == 0;
+        }
+#else
+        std::atomic<size_t> _refs;
+
+        void add_ref()
+        {
+            _refs.fetch_add(1,std::memory_order_relaxed);
+        }
+
+        bool release_ref()
+        {
+            return _refs.fetch_sub(1,std::memory_order_acq_rel) == 1;
+        }
+#endif
+        message_arena _arena;//the arena the message was created in, if any.
+
+        static void destroy(message* msg)
+        {
+            if(!msg->_arena.m_state)
+            {
+                delete msg;
+                return;
+            }
+            //keeps the blocks until the destructor is done with them.
+            message_arena arena(msg->_arena);
+            msg->~message();
+        }
+
+        friend class message_ptr;
+        template<typename T,typename... Args> friend ptr arena_create(message_arena const& arena,Args&&... args);
+#endif
+
     protected:
+#ifdef SIO_INTRUSIVE_MESSAGE_PTR
+        message(flag f):_flag(f),_refs(0),_arena(message_arena::no_arena()){}
+#else
         message(flag f):_flag(f){}
+#endif
+    };
+
+#ifdef SIO_INTRUSIVE_MESSAGE_PTR
+    inline message_ptr::message_ptr(message* p):m_p(p)
+    {
+        if(m_p)
+        {
+            m_p->add_ref();
+        }
+    }
+
+    inline message_ptr::message_ptr(message_ptr const& other):m_p(other.m_p)
+    {
+        if(m_p)
+        {
+            m_p->add_ref();
+        }
+    }
+
+    inline message_ptr::~message_ptr()
+    {
+        if(m_p && m_p->release_ref())
+        {
+            message::destroy(m_p);
+        }
+    }
+
+    inline long message_ptr::use_count() const
+    {
+        return m_p ? static_cast<long>(m_p->_refs) : 0;
+    }
+#endif
+
+    //Creates a T in arena, its memory is given back with the arena's blocks.
+    template<typename T,typename... Args>
+    message::ptr arena_create(message_arena const& arena,Args&&... args)
+    {
+        arena_allocator<T> alloc(arena);
+#ifdef SIO_INTRUSIVE_MESSAGE_PTR
+        T* msg = alloc.allocate(1);
+        alloc.construct(msg,std::forward<Args>(args)...);
+        static_cast<message*>(msg)->_arena = arena;
+        return message::ptr(msg);
+#else
+        return std::allocate_shared<T>(alloc,std::forward<Args>(args)...);
+#endif
+    }
+
+    //A slice of a received frame that a container decodes its children from on first access.
+    struct raw_json
+    {
+        raw_json():offset(0),length(0)
+        {
+        }
+
+        std::shared_ptr<const std::string> text;
+        size_t offset;
+        size_t length;
+
+        std::string str() const
+        {
+            return text ? text->substr(offset,length) : std::string();
+        }
     };
 
     class null_message : public message
@@ -120,11 +538,25 @@ namespace sio
         {
         }
 
+        //null, true, false and small ints never change, so their factories hand out instances
+        //shared by the library instead of allocating. Null when it is built without them, the
+        //decision and the range are kept out of line so they can't differ between binaries.
+        static message::ptr const* shared_instance();
+
     public:
         static message::ptr create()
         {
-            return ptr(new null_message());
+            message::ptr const* shared = shared_instance();
+            return shared ? *shared : ptr(new null_message());
+        }
+
+        static message::ptr create(message_arena const& arena)
+        {
+            message::ptr const* shared = shared_instance();
+            return shared ? *shared : arena_create<null_message>(arena);
         }
+
+        template<typename> friend class arena_allocator;
     };
 
     class bool_message : public message
@@ -137,12 +569,24 @@ namespace sio
         {
         }
 
+        //see null_message::shared_instance.
+        static message::ptr const* shared_instance(bool v);
+
     public:
         static message::ptr create(bool v)
         {
-            return ptr(new bool_message(v));
+            message::ptr const* shared = shared_instance(v);
+            return shared ? *shared : ptr(new bool_message(v));
         }
 
+        static message::ptr create(bool v,message_arena const& arena)
+        {
+            message::ptr const* shared = shared_instance(v);
+            return shared ? *shared : arena_create<bool_message>(arena,v);
+        }
+
+        template<typename> friend class arena_allocator;
+
         bool get_bool() const override
         {
             return _v;
@@ -161,9 +605,18 @@ namespace sio
     public:
         static message::ptr create(int64_t v)
         {
-            return ptr(new int_message(v));
+            message::ptr const* shared = shared_instance(v);
+            return shared ? *shared : ptr(new int_message(v));
         }
 
+        static message::ptr create(int64_t v,message_arena const& arena)
+        {
+            message::ptr const* shared = shared_instance(v);
+            return shared ? *shared : arena_create<int_message>(arena,v);
+        }
+
+        template<typename> friend class arena_allocator;
+
         int64_t get_int() const override
         {
             return _v;
@@ -173,6 +626,10 @@ namespace sio
         {
             return static_cast<double>(_v);//add double accessor for integer.
         }
+
+    private:
+        //see null_message::shared_instance, null outside the shared range.
+        static message::ptr const* shared_instance(int64_t v);
     };
 
     class double_message : public message
@@ -189,6 +646,13 @@ namespace sio
             return ptr(new double_message(v));
         }
 
+        static message::ptr create(double v,message_arena const& arena)
+        {
+            return arena_create<double_message>(arena,v);
+        }
+
+        template<typename> friend class arena_allocator;
+
         double get_double() const override
         {
             return _v;
@@ -218,6 +682,13 @@ namespace sio
             return ptr(new string_message(std::move(v)));
         }
 
+        static message::ptr create(std::string&& v,message_arena const& arena)
+        {
+            return arena_create<string_message>(arena,std::move(v));
+        }
+
+        template<typename> friend class arena_allocator;
+
         std::string const& get_string() const override
         {
             return _v;
@@ -231,12 +702,29 @@ namespace sio
             :message(flag_binary),_v(v)
         {
         }
+
+        binary_message(std::shared_ptr<const std::string>&& v)
+            :message(flag_binary),_v(std::move(v))
+        {
+        }
     public:
         static message::ptr create(std::shared_ptr<const std::string> const& v)
         {
             return ptr(new binary_message(v));
         }
 
+        static message::ptr create(std::shared_ptr<const std::string>&& v)
+        {
+            return ptr(new binary_message(std::move(v)));
+        }
+
+        static message::ptr create(std::shared_ptr<const std::string>&& v,message_arena const& arena)
+        {
+            return arena_create<binary_message>(arena,std::move(v));
+        }
+
+        template<typename> friend class arena_allocator;
+
         std::shared_ptr<const std::string> const& get_binary() const override
         {
             return _v;
@@ -245,145 +733,251 @@ namespace sio
 
     class array_message : public message
     {
-        std::vector<message::ptr> _v;
-        array_message():message(flag_array)
+        //lazily decoded containers fill _v on first access, which is not synchronized.
+        mutable std::vector<message::ptr> _v;
+        mutable raw_json _raw;
+        mutable bool _pending;
+
+        array_message():message(flag_array),_pending(false)
+        {
+        }
+
+        void materialize() const
         {
+            if(_pending)
+            {
+                _pending = false;
+                decode(_raw,_v);
+            }
         }
 
+        static void decode(raw_json const& raw,std::vector<message::ptr>& out);
+
     public:
         static message::ptr create()
         {
             return ptr(new array_message());
         }
 
+        static message::ptr create(message_arena const& arena)
+        {
+            return arena_create<array_message>(arena);
+        }
+
+        template<typename> friend class arena_allocator;
+
+        static message::ptr create_lazy(std::shared_ptr<const std::string> const& text,size_t offset,size_t length)
+        {
+            array_message* msg = new array_message();
+            msg->_raw.text = text;
+            msg->_raw.offset = offset;
+            msg->_raw.length = length;
+            msg->_pending = true;
+            return ptr(msg);
+        }
+
+        std::string get_raw_json() const override
+        {
+            return _raw.str();
+        }
+
+        raw_json const* get_pending_json() const override
+        {
+            return _pending ? &_raw : nullptr;
+        }
+
         void push(message::ptr const& msg)
         {
+            materialize();
             if(msg)
                 _v.push_back(msg);
         }
 
         void push(const std::string& text)
         {
+            materialize();
             _v.push_back(string_message::create(text));
         }
 
         void push(std::string&& text)
         {
+            materialize();
             _v.push_back(string_message::create(std::move(text)));
         }
 
         void push(std::shared_ptr<std::string> const& binary)
         {
+            materialize();
             if(binary)
                 _v.push_back(binary_message::create(binary));
         }
 
         void push(std::shared_ptr<const std::string> const& binary)
         {
+            materialize();
             if(binary)
                 _v.push_back(binary_message::create(binary));
         }
 
         void insert(size_t pos,message::ptr const& msg)
         {
+            materialize();
             _v.insert(_v.begin()+pos, msg);
         }
 
         void insert(size_t pos,const std::string& text)
         {
+            materialize();
             _v.insert(_v.begin()+pos, string_message::create(text));
         }
 
         void insert(size_t pos,std::string&& text)
         {
+            materialize();
             _v.insert(_v.begin()+pos, string_message::create(std::move(text)));
         }
 
         void insert(size_t pos,std::shared_ptr<std::string> const& binary)
         {
+            materialize();
             if(binary)
                 _v.insert(_v.begin()+pos, binary_message::create(binary));
         }
 
         void insert(size_t pos,std::shared_ptr<const std::string> const& binary)
         {
+            materialize();
             if(binary)
                 _v.insert(_v.begin()+pos, binary_message::create(binary));
         }
 
         size_t size() const
         {
+            materialize();
             return _v.size();
         }
 
         const message::ptr& at(size_t i) const
         {
+            materialize();
             return _v[i];
         }
 
         const message::ptr& operator[] (size_t i) const
         {
+            materialize();
             return _v[i];
         }
 
         std::vector<ptr>& get_vector() override
         {
+            materialize();
             return _v;
         }
 
         const std::vector<ptr>& get_vector() const override
         {
+            materialize();
             return _v;
         }
     };
 
     class object_message : public message
     {
-        std::map<std::string,message::ptr> _v;
-        object_message() : message(flag_object)
+        //lazily decoded containers fill _v on first access, which is not synchronized.
+        mutable std::map<std::string,message::ptr> _v;
+        mutable raw_json _raw;
+        mutable bool _pending;
+
+        object_message() : message(flag_object),_pending(false)
         {
         }
+
+        void materialize() const
+        {
+            if(_pending)
+            {
+                _pending = false;
+                decode(_raw,_v);
+            }
+        }
+
+        static void decode(raw_json const& raw,std::map<std::string,message::ptr>& out);
     public:
         static message::ptr create()
         {
             return ptr(new object_message());
         }
 
+        static message::ptr create(message_arena const& arena)
+        {
+            return arena_create<object_message>(arena);
+        }
+
+        template<typename> friend class arena_allocator;
+
+        static message::ptr create_lazy(std::shared_ptr<const std::string> const& text,size_t offset,size_t length)
+        {
+            object_message* msg = new object_message();
+            msg->_raw.text = text;
+            msg->_raw.offset = offset;
+            msg->_raw.length = length;
+            msg->_pending = true;
+            return ptr(msg);
+        }
+
+        std::string get_raw_json() const override
+        {
+            return _raw.str();
+        }
+
+        raw_json const* get_pending_json() const override
+        {
+            return _pending ? &_raw : nullptr;
+        }
+
         void insert(const std::string & key,message::ptr const& msg)
         {
+            materialize();
             _v[key] = msg;
         }
 
         void insert(const std::string & key,const std::string& text)
         {
+            materialize();
             _v[key] = string_message::create(text);
         }
 
         void insert(const std::string & key,std::string&& text)
         {
+            materialize();
             _v[key] = string_message::create(std::move(text));
         }
 
         void insert(const std::string & key,std::shared_ptr<std::string> const& binary)
         {
+            materialize();
             if(binary)
                 _v[key] = binary_message::create(binary);
         }
 
         void insert(const std::string & key,std::shared_ptr<const std::string> const& binary)
         {
+            materialize();
             if(binary)
                 _v[key] = binary_message::create(binary);
         }
 
         bool has(const std::string & key)
         {
+            materialize();
             return _v.find(key) != _v.end();
         }
 
         const message::ptr& at(const std::string & key) const
         {
-            static std::shared_ptr<message> not_found;
+            materialize();
+            static message::ptr not_found;
 
             std::map<std::string,message::ptr>::const_iterator it = _v.find(key);
             if (it != _v.cend()) return it->second;
@@ -397,16 +991,19 @@ namespace sio
 
         bool has(const std::string & key) const
         {
+            materialize();
             return _v.find(key) != _v.end();
         }
 
         std::map<std::string,message::ptr>& get_map() override
         {
+            materialize();
             return _v;
         }
 
         const std::map<std::string,message::ptr>& get_map() const override
         {
+            materialize();
             return _v;
         }
     };
@@ -428,12 +1025,18 @@ namespace sio
 
         }
 
-        list & operator= (const message::list && rhs)
+        list & operator= (message::list && rhs)
         {
             m_vector = std::move(rhs.m_vector);
             return *this;
         }
 
+        list & operator= (message::list const& rhs)
+        {
+            m_vector = rhs.m_vector;
+            return *this;
+        }
+
         template <typename T>
         list(T&& content,
             typename std::enable_if<std::is_same<std::vector<message::ptr>,typename std::remove_reference<T>::type>::value>::type* = 0):
@@ -545,18 +1148,37 @@ namespace sio
             return m_vector[i];
         }
 
-        message::ptr to_array_message(std::string const& event_name) const
+        message::ptr to_array_message(std::string const& event_name) const&
         {
             message::ptr arr = array_message::create();
+            arr->get_vector().reserve(m_vector.size() + 1);
             arr->get_vector().push_back(string_message::create(event_name));
             arr->get_vector().insert(arr->get_vector().end(),m_vector.begin(),m_vector.end());
             return arr;
         }
 
-        message::ptr to_array_message() const
+        //the messages are moved into the array, the list is left empty.
+        message::ptr to_array_message(std::string const& event_name) &&
         {
             message::ptr arr = array_message::create();
-            arr->get_vector().insert(arr->get_vector().end(),m_vector.begin(),m_vector.end());
+            arr->get_vector().reserve(m_vector.size() + 1);
+            arr->get_vector().push_back(string_message::create(event_name));
+            arr->get_vector().insert(arr->get_vector().end(),std::make_move_iterator(m_vector.begin()),std::make_move_iterator(m_vector.end()));
+            m_vector.clear();
+            return arr;
+        }
+
+        message::ptr to_array_message() const&
+        {
+            message::ptr arr = array_message::create();
+            arr->get_vector() = m_vector;
+            return arr;
+        }
+
+        message::ptr to_array_message() &&
+        {
+            message::ptr arr = array_message::create();
+            arr->get_vector().swap(m_vector);
             return arr;
         }
 
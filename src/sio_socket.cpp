@@ -1,12 +1,15 @@
 #include "sio_socket.h"
 #include "internal/sio_packet.h"
 #include "internal/sio_client_impl.h"
+#include "internal/sio_mpsc_queue.h"
 #include <asio/steady_timer.hpp>
 #include <asio/error_code.hpp>
-#include <queue>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstdarg>
 #include <functional>
+#include <set>
 
 #if (DEBUG || _DEBUG) && !defined(SIO_DISABLE_LOGGING)
 #define LOG(x) std::cout << x
@@ -34,7 +37,17 @@ namespace sio
         
         static inline event create_event(std::string const& nsp,std::string const& name,message::list&& message,bool need_ack)
         {
-            return event(nsp,name,message,need_ack);
+            return event(nsp,name,std::move(message),need_ack);
+        }
+
+        static inline message::list take_ack_message(event& ev)
+        {
+            return std::move(ev.get_ack_message_impl());
+        }
+
+        static inline event* new_event(std::string const& nsp,std::string const& name,message::list&& message,bool need_ack)
+        {
+            return new event(nsp,name,std::move(message),need_ack);
         }
     };
     
@@ -70,6 +83,12 @@ namespace sio
     }
     
     void event::put_ack_message(message::list const& ack_message)
+    {
+        if(m_need_ack)
+            m_ack_message = ack_message;
+    }
+
+    void event::put_ack_message(message::list&& ack_message)
     {
         if(m_need_ack)
             m_ack_message = std::move(ack_message);
@@ -104,6 +123,76 @@ namespace sio
         return m_ack_message;
     }
     
+    prepared_event::prepared_event()
+    {
+    }
+
+    prepared_event::prepared_event(std::string const& name,std::shared_ptr<const std::string> const& json_prefix):
+        m_name(name),
+        m_json_prefix(json_prefix)
+    {
+    }
+
+    const std::string& prepared_event::get_name() const
+    {
+        return m_name;
+    }
+
+    event_batch::entry::entry(std::string const& name, std::shared_ptr<const std::string> const& json_prefix, message::list const& args, std::function<void (message::list const&)> const& ack):
+        name(name),
+        json_prefix(json_prefix),
+        args(args),
+        ack(ack)
+    {
+    }
+
+    event_batch::entry::entry(std::string const& name, std::shared_ptr<const std::string> const& json_prefix, message::list&& args, std::function<void (message::list const&)> const& ack):
+        name(name),
+        json_prefix(json_prefix),
+        args(std::move(args)),
+        ack(ack)
+    {
+    }
+
+    event_batch& event_batch::add(std::string const& name, message::list const& msglist, std::function<void (message::list const&)> const& ack)
+    {
+        m_entries.push_back(entry(name, nullptr, msglist, ack));
+        return *this;
+    }
+
+    event_batch& event_batch::add(prepared_event const& event, message::list const& msglist, std::function<void (message::list const&)> const& ack)
+    {
+        m_entries.push_back(entry(event.m_name, event.m_json_prefix, msglist, ack));
+        return *this;
+    }
+
+    event_batch& event_batch::add(std::string const& name, message::list&& msglist, std::function<void (message::list const&)> const& ack)
+    {
+        m_entries.push_back(entry(name, nullptr, std::move(msglist), ack));
+        return *this;
+    }
+
+    event_batch& event_batch::add(prepared_event const& event, message::list&& msglist, std::function<void (message::list const&)> const& ack)
+    {
+        m_entries.push_back(entry(event.m_name, event.m_json_prefix, std::move(msglist), ack));
+        return *this;
+    }
+
+    size_t event_batch::size() const
+    {
+        return m_entries.size();
+    }
+
+    bool event_batch::empty() const
+    {
+        return m_entries.empty();
+    }
+
+    void event_batch::clear()
+    {
+        m_entries.clear();
+    }
+
     class socket::impl
     {
     public:
@@ -113,12 +202,14 @@ namespace sio
         
         void on(std::string const& event_name,event_listener_aux const& func);
         
-        void on(std::string const& event_name,event_listener const& func);
+        void on(std::string const& event_name,event_listener const& func,bool typed = false);
         
         void on_any(event_listener_aux const& func);
 
         void on_any(event_listener const& func);
 
+        void on_stream(std::string const& event_name,stream_listener const& listener);
+
         void off(std::string const& event_name);
         
         void off_all();
@@ -137,7 +228,17 @@ namespace sio
         
         void close();
         
-        void emit(std::string const& name, message::list const& msglist, std::function<void (message::list const&)> const& ack);
+        //msg is the whole ["name",args...] array.
+        void emit(message::ptr const& msg, std::function<void (message::list const&)> const& ack);
+
+        //args holds the arguments only, json_prefix starts the array.
+        void emit(std::shared_ptr<const std::string> const& json_prefix, message::ptr const& args, std::function<void (message::list const&)> const& ack);
+
+        bool emit_raw(std::shared_ptr<const std::string> const& json_prefix, std::string const& json_args, std::function<void (message::list const&)> const& ack, bool validate);
+
+        void emit_typed(std::shared_ptr<const std::string> const& json_prefix, std::shared_ptr<const json_args> const& args);
+
+        void emit_batch(event_batch const& batch);
         
         std::string const& get_namespace() const {return m_nsp;}
         
@@ -148,9 +249,15 @@ namespace sio
         
         void on_open();
         
-        void on_message_packet(packet const& packet);
+        void on_message_packet(packet& packet);
         
         void on_disconnect();
+
+        void drain_outbound();
+
+        bool wants_event(std::string const& name,bool& typed,bool& streamed);
+
+        void on_stream_packet(packet const& header,std::shared_ptr<const std::string> const& attachment,bool last);
         
     private:
         
@@ -158,20 +265,30 @@ namespace sio
         void on_socketio_event(const std::string& nsp, int msgId,const std::string& name, message::list&& message);
         void on_socketio_ack(int msgId, message::list const& message);
         void on_socketio_error(message::ptr const& err_message);
+
+        static bool split_event(message::ptr ptr,std::string& name,message::list& args);
         
         event_listener get_bind_listener_locked(string const& event);
+
+        bool get_stream_listener_locked(string const& event,stream_listener& listener);
+
+        void end_stream(bool completed);
         
-        void ack(int msgId,string const& name,message::list const& ack_message);
+        void ack(int msgId,string const& name,message::list&& ack_message);
+
+        int register_ack(std::function<void (message::list const&)> const& ack);
         
         void timeout_connection(const asio::error_code &ec);
         
         void send_connect();
         
         void send_packet(packet& p);
+
+        void request_drain();
         
         static event_listener s_null_event_listener;
         
-        static unsigned int s_global_event_id;
+        static std::atomic<unsigned int> s_global_event_id;
         
         sio::client_impl *m_client;
         
@@ -182,6 +299,17 @@ namespace sio
         std::map<unsigned int, std::function<void (message::list const&)> > m_acks;
         
         std::map<std::string, event_listener> m_event_binding;
+
+        //bound through on<T>, these only read json text so they are decoded lazily.
+        std::set<std::string> m_typed_events;
+
+        std::map<std::string, stream_listener> m_stream_binding;
+
+        //the binary event being streamed, network thread only.
+        std::unique_ptr<event> m_stream_event;
+        stream_listener m_stream_listener;
+        int m_stream_pack_id;
+        unsigned m_stream_next;
         
         event_listener m_event_listener;
 
@@ -189,11 +317,15 @@ namespace sio
         
         std::unique_ptr<asio::steady_timer> m_connection_timer;
         
-        std::queue<packet> m_packet_queue;
+        //emitting threads encode and push, the network thread pops and sends once connected.
+        mpsc_queue<encoded_packet> m_packet_queue;
+
+        //set while a drain is posted, so a burst of emits costs one hop.
+        std::atomic<bool> m_drain_pending;
         
         std::mutex m_event_mutex;
 
-		std::mutex m_packet_mutex;
+        std::mutex m_ack_mutex;
         
         friend class socket;
     };
@@ -203,22 +335,47 @@ namespace sio
         this->on(event_name,event_adapter::do_adapt(func));
     }
     
-    void socket::impl::on(std::string const& event_name,event_listener const& func)
+    void socket::impl::on(std::string const& event_name,event_listener const& func,bool typed)
     {
         std::lock_guard<std::mutex> guard(m_event_mutex);
         m_event_binding[event_name] = func;
+        if(typed)
+        {
+            m_typed_events.insert(event_name);
+        }
+        else
+        {
+            m_typed_events.erase(event_name);
+        }
     }
     
     void socket::impl::on_any(event_listener_aux const& func)
     {
+        std::lock_guard<std::mutex> guard(m_event_mutex);
         m_event_listener = event_adapter::do_adapt(func);
     }
     
     void socket::impl::on_any(event_listener const& func)
     {
+        std::lock_guard<std::mutex> guard(m_event_mutex);
         m_event_listener = func;
     }
 
+    void socket::impl::on_stream(std::string const& event_name,stream_listener const& listener)
+    {
+        std::lock_guard<std::mutex> guard(m_event_mutex);
+        m_stream_binding[event_name] = listener;
+    }
+
+    bool socket::impl::wants_event(std::string const& name,bool& typed,bool& streamed)
+    {
+        std::lock_guard<std::mutex> guard(m_event_mutex);
+        //a catch-all listener may read the tree, so the event is only lazy when no one else sees it.
+        typed = !m_event_listener && m_typed_events.count(name) > 0;
+        streamed = m_stream_binding.find(name) != m_stream_binding.end();
+        return streamed || m_event_listener || m_event_binding.find(name) != m_event_binding.end();
+    }
+
     void socket::impl::off(std::string const& event_name)
     {
         std::lock_guard<std::mutex> guard(m_event_mutex);
@@ -227,12 +384,16 @@ namespace sio
         {
             m_event_binding.erase(it);
         }
+        m_typed_events.erase(event_name);
+        m_stream_binding.erase(event_name);
     }
     
     void socket::impl::off_all()
     {
         std::lock_guard<std::mutex> guard(m_event_mutex);
         m_event_binding.clear();
+        m_typed_events.clear();
+        m_stream_binding.clear();
     }
     
     void socket::impl::on_error(error_listener const& l)
@@ -249,7 +410,10 @@ namespace sio
         m_client(client),
         m_connected(false),
         m_nsp(nsp),
-        m_auth(auth)
+        m_auth(auth),
+        m_stream_pack_id(-1),
+        m_stream_next(0),
+        m_drain_pending(false)
     {
         NULL_GUARD(client);
         if(m_client->opened())
@@ -263,26 +427,74 @@ namespace sio
         
     }
     
-    unsigned int socket::impl::s_global_event_id = 1;
+    std::atomic<unsigned int> socket::impl::s_global_event_id(1);
     
-    void socket::impl::emit(std::string const& name, message::list const& msglist, std::function<void (message::list const&)> const& ack)
+    int socket::impl::register_ack(std::function<void (message::list const&)> const& ack)
     {
-        NULL_GUARD(m_client);
-        message::ptr msg_ptr = msglist.to_array_message(name);
-        int pack_id;
         if(ack)
         {
-            pack_id = s_global_event_id++;
-            std::lock_guard<std::mutex> guard(m_event_mutex);
+            int pack_id = s_global_event_id++;
+            std::lock_guard<std::mutex> guard(m_ack_mutex);
             m_acks[pack_id] = ack;
+            return pack_id;
         }
-        else
+        return -1;
+    }
+
+    void socket::impl::emit(message::ptr const& msg, std::function<void (message::list const&)> const& ack)
+    {
+        NULL_GUARD(m_client);
+        int pack_id = register_ack(ack);
+        packet p(m_nsp, msg,pack_id);
+        send_packet(p);
+    }
+
+    void socket::impl::emit(std::shared_ptr<const std::string> const& json_prefix, message::ptr const& args, std::function<void (message::list const&)> const& ack)
+    {
+        NULL_GUARD(m_client);
+        int pack_id = register_ack(ack);
+        packet p(m_nsp, json_prefix, args, pack_id);
+        send_packet(p);
+    }
+    
+    bool socket::impl::emit_raw(std::shared_ptr<const std::string> const& json_prefix, std::string const& json_args, std::function<void (message::list const&)> const& ack, bool validate)
+    {
+        if(m_client == NULL)
         {
-            pack_id = -1;
+            return false;
         }
-        packet p(m_nsp, msg_ptr,pack_id);
+        if(validate && !json_args.empty() && !packet::validate_json(json_args))
+        {
+            LOG("Invalid raw json arguments, not sent."<<std::endl);
+            return false;
+        }
+        int pack_id = register_ack(ack);
+        packet p(m_nsp, json_prefix, std::make_shared<const std::string>(json_args), pack_id);
+        send_packet(p);
+        return true;
+    }
+    
+    void socket::impl::emit_typed(std::shared_ptr<const std::string> const& json_prefix, std::shared_ptr<const json_args> const& args)
+    {
+        NULL_GUARD(m_client);
+        packet p(m_nsp, json_prefix, args);
         send_packet(p);
     }
+
+    void socket::impl::emit_batch(event_batch const& batch)
+    {
+        NULL_GUARD(m_client);
+        for(auto it = batch.m_entries.begin(); it != batch.m_entries.end(); ++it)
+        {
+            int pack_id = register_ack(it->ack);
+            packet p = it->json_prefix ? packet(m_nsp, it->json_prefix, it->args.to_array_message(), pack_id) :
+                                         packet(m_nsp, it->args.to_array_message(it->name), pack_id);
+            encoded_packet encoded;
+            m_client->encode_outbound(p, encoded);
+            m_packet_queue.push(std::move(encoded));
+        }
+        request_drain();
+    }
     
     void socket::impl::send_connect()
     {
@@ -324,19 +536,7 @@ namespace sio
         {
             m_connected = true;
             m_client->on_socket_opened(m_nsp);
-
-            while (true) {
-				m_packet_mutex.lock();
-				if(m_packet_queue.empty())
-				{
-					m_packet_mutex.unlock();
-					return;
-				}
-				sio::packet front_pack = std::move(m_packet_queue.front());
-                m_packet_queue.pop();
-				m_packet_mutex.unlock();
-				m_client->send(front_pack);
-            }
+            drain_outbound();
         }
     }
     
@@ -352,12 +552,8 @@ namespace sio
             m_connection_timer.reset();
         }
         m_connected = false;
-		{
-			std::lock_guard<std::mutex> guard(m_packet_mutex);
-			while (!m_packet_queue.empty()) {
-				m_packet_queue.pop();
-			}
-		}
+        m_packet_queue.clear();
+        end_stream(false);
         client->on_socket_closed(m_nsp);
         client->remove_socket(m_nsp);
     }
@@ -373,14 +569,12 @@ namespace sio
         if(m_connected)
         {
             m_connected = false;
-			std::lock_guard<std::mutex> guard(m_packet_mutex);
-            while (!m_packet_queue.empty()) {
-                m_packet_queue.pop();
-            }
+            m_packet_queue.clear();
         }
+        end_stream(false);
     }
     
-    void socket::impl::on_message_packet(packet const& p)
+    void socket::impl::on_message_packet(packet& p)
     {
         NULL_GUARD(m_client);
         if(p.get_nsp() == m_nsp)
@@ -405,20 +599,11 @@ namespace sio
             case packet::type_binary_event:
             {
                 LOG("Received Message type (Event)"<<std::endl);
-                const message::ptr ptr = p.get_message();
-                if(ptr->get_flag() == message::flag_array)
+                std::string name;
+                message::list mlist;
+                if(split_event(p.release_message(),name,mlist))
                 {
-                    const array_message* array_ptr = static_cast<const array_message*>(ptr.get());
-                    if(array_ptr->get_vector().size() >= 1&&array_ptr->get_vector()[0]->get_flag() == message::flag_string)
-                    {
-                        const string_message* name_ptr = static_cast<const string_message*>(array_ptr->get_vector()[0].get());
-                        message::list mlist;
-                        for(size_t i = 1;i<array_ptr->get_vector().size();++i)
-                        {
-                            mlist.push(array_ptr->get_vector()[i]);
-                        }
-                        this->on_socketio_event(p.get_nsp(), p.get_pack_id(),name_ptr->get_string(), std::move(mlist));
-                    }
+                    this->on_socketio_event(p.get_nsp(), p.get_pack_id(),name, std::move(mlist));
                 }
 
                 break;
@@ -428,10 +613,18 @@ namespace sio
             case packet::type_binary_ack:
             {
                 LOG("Received Message type (ACK)"<<std::endl);
-                const message::ptr ptr = p.get_message();
+                const message::ptr ptr = p.release_message();
                 if(ptr->get_flag() == message::flag_array)
                 {
-					message::list msglist(ptr->get_vector());
+					message::list msglist;
+					if(ptr.use_count() == 1)
+					{
+						msglist = message::list(std::move(ptr->get_vector()));
+					}
+					else
+					{
+						msglist = message::list(ptr->get_vector());
+					}
 					this->on_socketio_ack(p.get_pack_id(),msglist);
                 }
 				else
@@ -458,17 +651,113 @@ namespace sio
         bool needAck = msgId >= 0;
         event ev = event_adapter::create_event(nsp,name, std::move(message),needAck);
         event_listener func = this->get_bind_listener_locked(name);
-        if(func)func(ev);
-        if (m_event_listener) m_event_listener(ev);
+        stream_listener stream;
+        if(!func && get_stream_listener_locked(name,stream))
+        {
+            //a streamed event that came without attachments, on_any does not see it either.
+            if(stream.on_header) stream.on_header(ev);
+            if(stream.on_end) stream.on_end(true);
+        }
+        else
+        {
+            if(func)func(ev);
+            if (m_event_listener) m_event_listener(ev);
+        }
         if(needAck)
         {
-            this->ack(msgId, name, ev.get_ack_message());
+            this->ack(msgId, name, event_adapter::take_ack_message(ev));
         }
     }
     
-    void socket::impl::ack(int msgId, const string &, const message::list &ack_message)
+    //When nothing else holds ptr, its elements are moved into args instead of copied.
+    bool socket::impl::split_event(message::ptr ptr,std::string& name,message::list& args)
     {
-        packet p(m_nsp, ack_message.to_array_message(),msgId,true);
+        if(ptr && ptr->get_flag() == message::flag_array)
+        {
+            std::vector<message::ptr>& vec = ptr->get_vector();
+            if(vec.size() >= 1&&vec[0]->get_flag() == message::flag_string)
+            {
+                name = vec[0]->get_string();
+                std::vector<message::ptr> rest;
+                if(ptr.use_count() == 1)
+                {
+                    vec.erase(vec.begin());
+                    rest.swap(vec);
+                }
+                else
+                {
+                    rest.assign(vec.begin() + 1,vec.end());
+                }
+                //like message::list::push, arguments that failed to decode are left out.
+                rest.erase(std::remove(rest.begin(),rest.end(),message::ptr()),rest.end());
+                args = message::list(std::move(rest));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void socket::impl::on_stream_packet(packet const& header,std::shared_ptr<const std::string> const& attachment,bool last)
+    {
+        NULL_GUARD(m_client);
+        if(header.get_nsp() != m_nsp)
+        {
+            return;
+        }
+        if(!attachment)
+        {
+            end_stream(false);
+            if(last)
+            {
+                return;//cut short by a new text frame.
+            }
+            std::string name;
+            message::list mlist;
+            stream_listener listener;
+            if(!split_event(header.get_message(),name,mlist) || !get_stream_listener_locked(name,listener))
+            {
+                return;
+            }
+            int pack_id = header.get_pack_id();
+            m_stream_event.reset(event_adapter::new_event(m_nsp,name,std::move(mlist),pack_id >= 0));
+            m_stream_listener = listener;
+            m_stream_pack_id = pack_id;
+            m_stream_next = 0;
+            if(m_stream_listener.on_header) m_stream_listener.on_header(*m_stream_event);
+            return;
+        }
+        if(!m_stream_event)
+        {
+            return;
+        }
+        if(m_stream_listener.on_data) m_stream_listener.on_data(m_stream_next++,attachment);
+        if(last)
+        {
+            end_stream(true);
+        }
+    }
+
+    //Forgets the event being streamed, on_end tells its listener whether every attachment
+    //arrived. The ack is only sent for a completed event.
+    void socket::impl::end_stream(bool completed)
+    {
+        if(!m_stream_event)
+        {
+            return;
+        }
+        std::unique_ptr<event> ev(std::move(m_stream_event));
+        stream_listener listener;
+        std::swap(listener,m_stream_listener);
+        if(listener.on_end) listener.on_end(completed);
+        if(completed && ev->need_ack())
+        {
+            this->ack(m_stream_pack_id, ev->get_name(), event_adapter::take_ack_message(*ev));
+        }
+    }
+
+    void socket::impl::ack(int msgId, const string &, message::list&& ack_message)
+    {
+        packet p(m_nsp, std::move(ack_message).to_array_message(),msgId,true);
         send_packet(p);
     }
     
@@ -476,7 +765,7 @@ namespace sio
     {
         std::function<void (message::list const&)> l;
         {
-            std::lock_guard<std::mutex> guard(m_event_mutex);
+            std::lock_guard<std::mutex> guard(m_ack_mutex);
             auto it = m_acks.find(msgId);
             if(it!=m_acks.end())
             {
@@ -505,32 +794,54 @@ namespace sio
         this->on_close();
     }
     
+    //Encodes on the calling thread, only the hand-off to the network thread is deferred.
     void socket::impl::send_packet(sio::packet &p)
     {
         NULL_GUARD(m_client);
-        if(m_connected)
+        encoded_packet encoded;
+        m_client->encode_outbound(p, encoded);
+        m_packet_queue.push(std::move(encoded));
+        request_drain();
+    }
+
+    void socket::impl::request_drain()
+    {
+        if(!m_drain_pending.exchange(true))
         {
-            while (true) {
-				m_packet_mutex.lock();
-				if(m_packet_queue.empty())
-				{
-					m_packet_mutex.unlock();
-					break;
-				}
-				sio::packet front_pack = std::move(m_packet_queue.front());
-                m_packet_queue.pop();
-				m_packet_mutex.unlock();
-				m_client->send(front_pack);
-            }
-            m_client->send(p);
+            //looked up by namespace when it runs, the socket may be gone by then.
+            m_client->get_io_service().dispatch(std::bind(&client_impl::drain_socket,m_client,m_nsp));
         }
-        else
+    }
+
+    //Network thread only. Packets stay queued until the namespace is connected.
+    void socket::impl::drain_outbound()
+    {
+        NULL_GUARD(m_client);
+        //cleared before popping so a push racing with this drain requests another one.
+        m_drain_pending.exchange(false);
+        if(!m_connected)
         {
-			std::lock_guard<std::mutex> guard(m_packet_mutex);
-            m_packet_queue.push(p);
+            return;
+        }
+        encoded_packet encoded;
+        while(m_packet_queue.pop(encoded))
+        {
+            m_client->send_encoded(encoded);
         }
     }
     
+    bool socket::impl::get_stream_listener_locked(const string &event,stream_listener& listener)
+    {
+        std::lock_guard<std::mutex> guard(m_event_mutex);
+        auto it = m_stream_binding.find(event);
+        if(it!=m_stream_binding.end())
+        {
+            listener = it->second;
+            return true;
+        }
+        return false;
+    }
+
     socket::event_listener socket::impl::get_bind_listener_locked(const string &event)
     {
         std::lock_guard<std::mutex> guard(m_event_mutex);
@@ -562,6 +873,16 @@ namespace sio
         m_impl->on(event_name, func);
     }
     
+    void socket::on_typed(std::string const& event_name,event_listener const& func)
+    {
+        m_impl->on(event_name, func, true);
+    }
+
+    void socket::on_stream(std::string const& event_name,stream_listener const& listener)
+    {
+        m_impl->on_stream(event_name, listener);
+    }
+
     void socket::on_any(event_listener_aux const& func)
     {
         m_impl->on_any(func);
@@ -599,7 +920,63 @@ namespace sio
 
     void socket::emit(std::string const& name, message::list const& msglist, std::function<void (message::list const&)> const& ack)
     {
-        m_impl->emit(name, msglist,ack);
+        m_impl->emit(msglist.to_array_message(name),ack);
+    }
+
+    void socket::emit(std::string const& name, message::list&& msglist, std::function<void (message::list const&)> const& ack)
+    {
+        m_impl->emit(std::move(msglist).to_array_message(name),ack);
+    }
+    
+    prepared_event socket::prepare(std::string const& name) const
+    {
+        return prepared_event(name, packet::encode_event_prefix(name));
+    }
+
+    void socket::emit(prepared_event const& event, message::list const& msglist, std::function<void (message::list const&)> const& ack)
+    {
+        if(!event.m_json_prefix)
+        {
+            //default constructed handle, nothing was prepared.
+            m_impl->emit(msglist.to_array_message(event.get_name()), ack);
+            return;
+        }
+        m_impl->emit(event.m_json_prefix, msglist.to_array_message(), ack);
+    }
+
+    void socket::emit(prepared_event const& event, message::list&& msglist, std::function<void (message::list const&)> const& ack)
+    {
+        if(!event.m_json_prefix)
+        {
+            m_impl->emit(std::move(msglist).to_array_message(event.get_name()), ack);
+            return;
+        }
+        m_impl->emit(event.m_json_prefix, std::move(msglist).to_array_message(), ack);
+    }
+    
+    bool socket::emit_raw(std::string const& name, std::string const& json_args, std::function<void (message::list const&)> const& ack, bool validate)
+    {
+        return m_impl->emit_raw(packet::encode_event_prefix(name), json_args, ack, validate);
+    }
+
+    bool socket::emit_raw(prepared_event const& event, std::string const& json_args, std::function<void (message::list const&)> const& ack, bool validate)
+    {
+        std::shared_ptr<const std::string> json_prefix = event.m_json_prefix;
+        if(!json_prefix)
+        {
+            json_prefix = packet::encode_event_prefix(event.get_name());
+        }
+        return m_impl->emit_raw(json_prefix, json_args, ack, validate);
+    }
+    
+    void socket::emit_typed(std::string const& name, std::shared_ptr<const json_args> const& args)
+    {
+        m_impl->emit_typed(packet::encode_event_prefix(name), args);
+    }
+
+    void socket::emit_batch(event_batch const& batch)
+    {
+        m_impl->emit_batch(batch);
     }
     
     std::string const& socket::get_namespace() const
@@ -622,7 +999,7 @@ namespace sio
         m_impl->on_open();
     }
     
-    void socket::on_message_packet(packet const& p)
+    void socket::on_message_packet(packet& p)
     {
         m_impl->on_message_packet(p);
     }
@@ -631,6 +1008,21 @@ namespace sio
     {
         m_impl->on_disconnect();
     }
+
+    void socket::drain_outbound()
+    {
+        m_impl->drain_outbound();
+    }
+
+    bool socket::wants_event(std::string const& name,bool& typed,bool& streamed)
+    {
+        return m_impl->wants_event(name,typed,streamed);
+    }
+
+    void socket::on_stream_packet(packet const& header,std::shared_ptr<const std::string> const& attachment,bool last)
+    {
+        m_impl->on_stream_packet(header,attachment,last);
+    }
 }
 
 
@@ -1,6 +1,8 @@
 #ifndef SIO_SOCKET_H
 #define SIO_SOCKET_H
 #include "sio_message.h"
+#include "sio_typed.h"
+#include "sio_value.h"
 #include <functional>
 namespace sio
 {
@@ -20,6 +22,8 @@ namespace sio
         bool need_ack() const;
         
         void put_ack_message(message::list const& ack_message);
+
+        void put_ack_message(message::list&& ack_message);
         
         message::list const& get_ack_message() const;
         
@@ -41,6 +45,75 @@ namespace sio
     
     class client_impl;
     class packet;
+    class socket;
+
+    //Receives a binary event while its attachments arrive, see socket::on_stream.
+    struct stream_listener
+    {
+        //the event, its binary arguments are still {"_placeholder":true,"num":n} objects.
+        std::function<void(event& header)> on_header;
+        //attachment num in arrival order, nothing holds on to data after the call.
+        std::function<void(unsigned num,std::shared_ptr<const std::string> const& data)> on_data;
+        //completed after the last attachment, an ack put on the header event is sent now.
+        //Not completed when the event was cut short by the next event, a disconnect or a close,
+        //no ack is sent then.
+        std::function<void(bool completed)> on_end;
+    };
+
+    //An event name encoded once by socket::prepare, emitting through it only serializes the arguments.
+    class prepared_event
+    {
+    public:
+        prepared_event();
+
+        const std::string& get_name() const;
+
+    private:
+        prepared_event(std::string const& name,std::shared_ptr<const std::string> const& json_prefix);
+
+        std::string m_name;
+        std::shared_ptr<const std::string> m_json_prefix;
+
+        friend class socket;
+        friend class event_batch;
+    };
+
+    //Collects events to emit together, the whole batch reaches the network thread in one hop.
+    class event_batch
+    {
+    public:
+        event_batch& add(std::string const& name, message::list const& msglist = nullptr, std::function<void (message::list const&)> const& ack = nullptr);
+
+        event_batch& add(prepared_event const& event, message::list const& msglist = nullptr, std::function<void (message::list const&)> const& ack = nullptr);
+
+        //move the messages of msglist into the batch instead of copying them.
+        event_batch& add(std::string const& name, message::list&& msglist, std::function<void (message::list const&)> const& ack = nullptr);
+
+        event_batch& add(prepared_event const& event, message::list&& msglist, std::function<void (message::list const&)> const& ack = nullptr);
+
+        size_t size() const;
+
+        bool empty() const;
+
+        void clear();
+
+    private:
+        struct entry
+        {
+            entry(std::string const& name, std::shared_ptr<const std::string> const& json_prefix, message::list const& args, std::function<void (message::list const&)> const& ack);
+
+            entry(std::string const& name, std::shared_ptr<const std::string> const& json_prefix, message::list&& args, std::function<void (message::list const&)> const& ack);
+
+            std::string name;
+            std::shared_ptr<const std::string> json_prefix;
+            message::list args;
+            std::function<void (message::list const&)> ack;
+        };
+
+        std::vector<entry> m_entries;
+
+        friend class socket;
+    };
     
     //The name 'socket' is taken from concept of official socket.io.
     class socket
@@ -60,6 +133,25 @@ namespace sio
         
         void on(std::string const& event_name,event_listener_aux const& func);
         
+        //Decodes the first argument straight into T (see sio_typed.h), func is skipped if it
+        //does not match. Call as on<T>(name, func).
+        template<typename T>
+        void on(std::string const& event_name,std::function<void (T const&)> const& func)
+        {
+            on_typed(event_name,[func](event& ev)
+            {
+                T value;
+                if(from_message(ev.get_message(),value))
+                {
+                    func(value);
+                }
+            });
+        }
+        
+        //Binary events bound here are not buffered until complete, each attachment is handed to
+        //the listener as its frame arrives. They are not reported to on_any.
+        void on_stream(std::string const& event_name,stream_listener const& listener);
+        
         void off(std::string const& event_name);
         
         void on_any(event_listener const& func);
@@ -75,6 +167,31 @@ namespace sio
         void off_error();
 
         void emit(std::string const& name, message::list const& msglist = nullptr, std::function<void (message::list const&)> const& ack = nullptr);
+
+        //moves the messages of msglist into the packet instead of copying them.
+        void emit(std::string const& name, message::list&& msglist, std::function<void (message::list const&)> const& ack = nullptr);
+
+        //Writes args straight into the frame with their json_traits (see sio_typed.h), no message
+        //tree is built. Binary members are sent as attachments.
+        template<typename... Args>
+        typename std::enable_if<all_have_json_traits<Args...>::value>::type emit(std::string const& name, Args const&... args)
+        {
+            emit_typed(name, std::make_shared<typed_args<Args...> >(args...));
+        }
+
+        prepared_event prepare(std::string const& name) const;
+
+        void emit(prepared_event const& event, message::list const& msglist = nullptr, std::function<void (message::list const&)> const& ack = nullptr);
+
+        void emit(prepared_event const& event, message::list&& msglist, std::function<void (message::list const&)> const& ack = nullptr);
+
+        //json_args is the json text of a single argument, spliced into the frame as is (empty for no argument).
+        //Returns false without sending if validate is set and json_args is not one well formed json value.
+        bool emit_raw(std::string const& name, std::string const& json_args, std::function<void (message::list const&)> const& ack = nullptr, bool validate = false);
+
+        bool emit_raw(prepared_event const& event, std::string const& json_args, std::function<void (message::list const&)> const& ack = nullptr, bool validate = false);
+
+        void emit_batch(event_batch const& batch);
         
         std::string const& get_namespace() const;
         
@@ -89,11 +206,21 @@ namespace sio
         
         void on_disconnect();
         
-        void on_message_packet(packet const& p);
+        void on_message_packet(packet& p);
+
+        void drain_outbound();
+
+        bool wants_event(std::string const& name,bool& typed,bool& streamed);
+
+        void on_stream_packet(packet const& header,std::shared_ptr<const std::string> const& attachment,bool last);
         
         friend class client_impl;
         
     private:
+        void on_typed(std::string const& event_name,event_listener const& func);
+
+        void emit_typed(std::string const& name, std::shared_ptr<const json_args> const& args);
+
         //disable copy constructor and assign operator.
         socket(socket const&){}
         void operator=(socket const&){}
@@ -0,0 +1,653 @@
+//
+//  sio_typed.h
+//
+//  Compile time descriptions of user types, so events can be decoded straight into them
+//  and emitted from them instead of going through message trees.
+//
+
+#ifndef SIO_TYPED_H
+#define SIO_TYPED_H
+#include "sio_message.h"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+namespace sio
+{
+    //SAX style events a json value is reported with.
+    class json_handler
+    {
+    public:
+        virtual ~json_handler(){}
+
+        virtual bool null_value() = 0;
+
+        virtual bool bool_value(bool b) = 0;
+
+        virtual bool int_value(int64_t i) = 0;
+
+        //numbers above INT64_MAX, smaller ones are reported through int_value.
+        virtual bool uint_value(uint64_t u)
+        {
+            return double_value(static_cast<double>(u));
+        }
+
+        virtual bool double_value(double d) = 0;
+
+        virtual bool string_value(const char* str,size_t length) = 0;
+
+        virtual bool binary_value(std::shared_ptr<const std::string> const& data) = 0;
+
+        virtual bool start_object() = 0;
+
+        virtual bool key(const char* str,size_t length) = 0;
+
+        virtual bool end_object() = 0;
+
+        virtual bool start_array() = 0;
+
+        virtual bool end_array() = 0;
+    };
+
+    //Reports msg to handler. Lazily decoded containers are read from their json text,
+    //their children are never materialized.
+    bool visit_message(message::ptr const& msg,json_handler& handler);
+
+    //Describe a struct by specializing reflect for it:
+    //
+    //  template<> struct reflect<point>
+    //  {
+    //      template<typename V> static void visit(V& v) { v("x",&point::x); v("y",&point::y); }
+    //  };
+    template<typename T>
+    struct reflect
+    {
+        typedef void not_reflected;
+    };
+
+    template<typename T>
+    class is_reflected
+    {
+        template<typename U> static char test(typename reflect<U>::not_reflected*);
+        template<typename U> static long test(...);
+    public:
+        static const bool value = sizeof(test<T>(0)) != sizeof(char);
+    };
+
+    //How json values are stored into one type, a null entry rejects that kind of value.
+    struct json_read_ops
+    {
+        bool (*bool_value)(void* target,bool b);
+        bool (*int_value)(void* target,int64_t i);
+        bool (*double_value)(void* target,double d);
+        bool (*string_value)(void* target,const char* str,size_t length);
+        bool (*binary_value)(void* target,std::shared_ptr<const std::string> const& data);
+        bool (*start_object)(void* target);
+        //finds the member for key, false if there is none.
+        bool (*field)(void* target,const char* key,size_t length,void** member,json_read_ops const** member_ops);
+        bool (*start_array)(void* target);
+        //appends an element and returns it.
+        void* (*element)(void* target,json_read_ops const** element_ops);
+        //null is accepted by every type and leaves the target as is when this is not set.
+        bool (*null_value)(void* target);
+        //numbers above INT64_MAX, read through double_value when this is not set.
+        bool (*uint_value)(void* target,uint64_t u);
+    };
+
+    template<typename T,typename Enable = void>
+    struct json_traits;
+
+    template<>
+    struct json_traits<bool>
+    {
+        static bool read_bool(void* target,bool b)
+        {
+            *static_cast<bool*>(target) = b;
+            return true;
+        }
+
+        static void write(bool b,json_handler& out)
+        {
+            out.bool_value(b);
+        }
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { &read_bool, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+            return ops;
+        }
+    };
+
+    template<typename T>
+    struct json_traits<T,typename std::enable_if<std::is_integral<T>::value && !std::is_same<T,bool>::value>::type>
+    {
+        static bool read_int(void* target,int64_t i)
+        {
+            T value = static_cast<T>(i);
+            if(static_cast<int64_t>(value) != i || (std::is_unsigned<T>::value && i < 0))
+            {
+                return false;//out of range for T.
+            }
+            *static_cast<T*>(target) = value;
+            return true;
+        }
+
+        static bool read_uint(void* target,uint64_t u)
+        {
+            if(!std::is_unsigned<T>::value || u > static_cast<uint64_t>(std::numeric_limits<T>::max()))
+            {
+                return false;//out of range for T.
+            }
+            *static_cast<T*>(target) = static_cast<T>(u);
+            return true;
+        }
+
+        static void write(T i,json_handler& out)
+        {
+            write_integer(i,out,std::is_unsigned<T>());
+        }
+
+    private:
+        //not named write, has_json_traits takes the address of write so it must not be overloaded.
+        static void write_integer(T i,json_handler& out,std::true_type)
+        {
+            uint64_t u = i;
+            if(u > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+            {
+                out.uint_value(u);
+                return;
+            }
+            out.int_value(static_cast<int64_t>(u));
+        }
+
+        static void write_integer(T i,json_handler& out,std::false_type)
+        {
+            out.int_value(static_cast<int64_t>(i));
+        }
+
+    public:
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { nullptr, &read_int, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, &read_uint };
+            return ops;
+        }
+    };
+
+    template<typename T>
+    struct json_traits<T,typename std::enable_if<std::is_floating_point<T>::value>::type>
+    {
+        static bool read_int(void* target,int64_t i)
+        {
+            *static_cast<T*>(target) = static_cast<T>(i);
+            return true;
+        }
+
+        static bool read_double(void* target,double d)
+        {
+            *static_cast<T*>(target) = static_cast<T>(d);
+            return true;
+        }
+
+        static void write(T d,json_handler& out)
+        {
+            out.double_value(static_cast<double>(d));
+        }
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { nullptr, &read_int, &read_double, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+            return ops;
+        }
+    };
+
+    template<>
+    struct json_traits<std::string>
+    {
+        static bool read_string(void* target,const char* str,size_t length)
+        {
+            static_cast<std::string*>(target)->assign(str,length);
+            return true;
+        }
+
+        static void write(std::string const& str,json_handler& out)
+        {
+            out.string_value(str.data(),str.size());
+        }
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { nullptr, nullptr, nullptr, &read_string, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+            return ops;
+        }
+    };
+
+    //binary attachments.
+    template<>
+    struct json_traits<std::shared_ptr<const std::string> >
+    {
+        static bool read_binary(void* target,std::shared_ptr<const std::string> const& data)
+        {
+            *static_cast<std::shared_ptr<const std::string>*>(target) = data;
+            return true;
+        }
+
+        //sent as an attachment, a null pointer as json null.
+        static void write(std::shared_ptr<const std::string> const& data,json_handler& out)
+        {
+            if(data)
+            {
+                out.binary_value(data);
+            }
+            else
+            {
+                out.null_value();
+            }
+        }
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { nullptr, nullptr, nullptr, nullptr, &read_binary, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+            return ops;
+        }
+    };
+
+    template<typename T>
+    struct json_traits<std::vector<T> >
+    {
+        static bool start_array(void* target)
+        {
+            static_cast<std::vector<T>*>(target)->clear();
+            return true;
+        }
+
+        static void* element(void* target,json_read_ops const** element_ops)
+        {
+            std::vector<T>* vec = static_cast<std::vector<T>*>(target);
+            vec->push_back(T());
+            *element_ops = &json_traits<T>::read_ops();
+            return &vec->back();
+        }
+
+        static void write(std::vector<T> const& vec,json_handler& out)
+        {
+            out.start_array();
+            for(auto it = vec.begin();it!=vec.end();++it)
+            {
+                json_traits<T>::write(*it,out);
+            }
+            out.end_array();
+        }
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, &start_array, &element, nullptr, nullptr };
+            return ops;
+        }
+    };
+
+    template<typename T>
+    struct json_traits<T,typename std::enable_if<is_reflected<T>::value>::type>
+    {
+        struct member_finder
+        {
+            T* object;
+            const char* key;
+            size_t length;
+            void* member;
+            json_read_ops const* ops;
+
+            template<typename F>
+            void operator()(const char* name,F T::* field)
+            {
+                if(!member && std::strlen(name) == length && std::memcmp(name,key,length) == 0)
+                {
+                    member = &(object->*field);
+                    ops = &json_traits<F>::read_ops();
+                }
+            }
+        };
+
+        struct member_writer
+        {
+            T const* object;
+            json_handler* out;
+
+            template<typename F>
+            void operator()(const char* name,F T::* field)
+            {
+                out->key(name,std::strlen(name));
+                json_traits<F>::write(object->*field,*out);
+            }
+        };
+
+        static bool start_object(void*)
+        {
+            return true;
+        }
+
+        static void write(T const& value,json_handler& out)
+        {
+            member_writer writer = { &value, &out };
+            out.start_object();
+            reflect<T>::visit(writer);
+            out.end_object();
+        }
+
+        static bool field(void* target,const char* key,size_t length,void** member,json_read_ops const** member_ops)
+        {
+            member_finder finder = { static_cast<T*>(target), key, length, nullptr, nullptr };
+            reflect<T>::visit(finder);
+            *member = finder.member;
+            *member_ops = finder.ops;
+            return finder.member != nullptr;
+        }
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { nullptr, nullptr, nullptr, nullptr, nullptr, &start_object, &field, nullptr, nullptr, nullptr, nullptr };
+            return ops;
+        }
+    };
+
+    template<typename T>
+    class has_json_traits
+    {
+        template<typename U> static char test(decltype(&json_traits<U>::write));
+        template<typename U> static long test(...);
+    public:
+        static const bool value = sizeof(test<T>(nullptr)) == sizeof(char);
+    };
+
+    template<typename... Ts>
+    struct all_have_json_traits : std::true_type
+    {
+    };
+
+    template<typename T,typename... Ts>
+    struct all_have_json_traits<T,Ts...> : std::integral_constant<bool,has_json_traits<T>::value && all_have_json_traits<Ts...>::value>
+    {
+    };
+
+    //Arguments of one typed emit, written as consecutive root values when the frame is encoded.
+    class json_args
+    {
+    public:
+        virtual ~json_args(){}
+
+        virtual void write(json_handler& out) const = 0;
+    };
+
+    template<typename... Args>
+    class typed_args : public json_args
+    {
+    public:
+        explicit typed_args(Args const&... args):
+            m_args(args...)
+        {
+        }
+
+        void write(json_handler& out) const override
+        {
+            write_from<0>(out);
+        }
+
+    private:
+        template<size_t I>
+        typename std::enable_if<(I < sizeof...(Args))>::type write_from(json_handler& out) const
+        {
+            json_traits<typename std::tuple_element<I,std::tuple<Args...> >::type>::write(std::get<I>(m_args),out);
+            write_from<I + 1>(out);
+        }
+
+        template<size_t I>
+        typename std::enable_if<(I == sizeof...(Args))>::type write_from(json_handler&) const
+        {
+        }
+
+        std::tuple<Args...> m_args;
+    };
+
+    //Fills one value from json_handler events. Unknown object members are skipped, a value of
+    //the wrong kind fails the whole read. Members missing from the json keep their value.
+    class json_reader : public json_handler
+    {
+    public:
+        template<typename T>
+        explicit json_reader(T& root):
+            m_root(&root),
+            m_root_ops(&json_traits<T>::read_ops()),
+            m_member(nullptr),
+            m_member_ops(nullptr),
+            m_skip(0),
+            m_done(false)
+        {
+        }
+
+        bool complete() const
+        {
+            return m_done && m_stack.empty();
+        }
+
+        bool null_value() override
+        {
+            void* target;
+            json_read_ops const* ops;
+            return scalar_target(target,ops) && (!target || !ops->null_value || ops->null_value(target));
+        }
+
+        bool bool_value(bool b) override
+        {
+            void* target;
+            json_read_ops const* ops;
+            return scalar_target(target,ops) && (!target || (ops->bool_value && ops->bool_value(target,b)));
+        }
+
+        bool int_value(int64_t i) override
+        {
+            void* target;
+            json_read_ops const* ops;
+            return scalar_target(target,ops) && (!target || (ops->int_value && ops->int_value(target,i)));
+        }
+
+        bool uint_value(uint64_t u) override
+        {
+            void* target;
+            json_read_ops const* ops;
+            if(!scalar_target(target,ops))
+            {
+                return false;
+            }
+            if(!target)
+            {
+                return true;
+            }
+            if(ops->uint_value)
+            {
+                return ops->uint_value(target,u);
+            }
+            return ops->double_value && ops->double_value(target,static_cast<double>(u));
+        }
+
+        bool double_value(double d) override
+        {
+            void* target;
+            json_read_ops const* ops;
+            return scalar_target(target,ops) && (!target || (ops->double_value && ops->double_value(target,d)));
+        }
+
+        bool string_value(const char* str,size_t length) override
+        {
+            void* target;
+            json_read_ops const* ops;
+            return scalar_target(target,ops) && (!target || (ops->string_value && ops->string_value(target,str,length)));
+        }
+
+        bool binary_value(std::shared_ptr<const std::string> const& data) override
+        {
+            void* target;
+            json_read_ops const* ops;
+            return scalar_target(target,ops) && (!target || (ops->binary_value && ops->binary_value(target,data)));
+        }
+
+        bool start_object() override
+        {
+            return start(true);
+        }
+
+        bool key(const char* str,size_t length) override
+        {
+            if(m_skip > 0)
+            {
+                return true;
+            }
+            if(m_stack.empty() || !m_stack.back().object)
+            {
+                return false;
+            }
+            frame const& top = m_stack.back();
+            if(!top.ops->field || !top.ops->field(top.target,str,length,&m_member,&m_member_ops))
+            {
+                m_member = nullptr;
+            }
+            return true;
+        }
+
+        bool end_object() override
+        {
+            return end();
+        }
+
+        bool start_array() override
+        {
+            return start(false);
+        }
+
+        bool end_array() override
+        {
+            return end();
+        }
+
+    private:
+        struct frame
+        {
+            void* target;
+            json_read_ops const* ops;
+            bool object;
+        };
+
+        //Where the value starting now goes, target is null if it is to be skipped.
+        bool value_target(void*& target,json_read_ops const*& ops)
+        {
+            if(m_stack.empty())
+            {
+                if(!m_root)
+                {
+                    return false;//only one root value.
+                }
+                target = m_root;
+                ops = m_root_ops;
+                m_root = nullptr;
+                return true;
+            }
+            frame const& top = m_stack.back();
+            if(top.object)
+            {
+                target = m_member;
+                ops = m_member_ops;
+                m_member = nullptr;
+                return true;
+            }
+            target = top.ops->element(top.target,&ops);
+            return true;
+        }
+
+        bool scalar_target(void*& target,json_read_ops const*& ops)
+        {
+            target = nullptr;
+            if(m_skip > 0)
+            {
+                return true;
+            }
+            if(!value_target(target,ops))
+            {
+                return false;
+            }
+            if(m_stack.empty())
+            {
+                m_done = true;
+            }
+            return true;
+        }
+
+        bool start(bool object)
+        {
+            if(m_skip > 0)
+            {
+                ++m_skip;
+                return true;
+            }
+            void* target;
+            json_read_ops const* ops;
+            if(!value_target(target,ops))
+            {
+                return false;
+            }
+            if(!target)
+            {
+                m_skip = 1;
+                return true;
+            }
+            bool (*start_fn)(void*) = object ? ops->start_object : ops->start_array;
+            if(!start_fn || !start_fn(target))
+            {
+                return false;
+            }
+            frame f = { target, ops, object };
+            m_stack.push_back(f);
+            return true;
+        }
+
+        bool end()
+        {
+            if(m_skip > 0)
+            {
+                --m_skip;
+                return true;
+            }
+            if(m_stack.empty())
+            {
+                return false;
+            }
+            m_stack.pop_back();
+            if(m_stack.empty())
+            {
+                m_done = true;
+            }
+            return true;
+        }
+
+        void* m_root;
+        json_read_ops const* m_root_ops;
+        void* m_member;
+        json_read_ops const* m_member_ops;
+        std::vector<frame> m_stack;
+        int m_skip;
+        bool m_done;
+    };
+
+    //Decodes msg into out, false if its shape does not match T.
+    template<typename T>
+    bool from_message(message::ptr const& msg,T& out)
+    {
+        json_reader reader(out);
+        return visit_message(msg,reader) && reader.complete();
+    }
+}
+
+#endif // SIO_TYPED_H
@@ -0,0 +1,609 @@
+//
+//  sio_value.h
+//
+//  A json value held by value: scalars are stored inline, arrays and objects in contiguous
+//  vectors. Emitted and received through json_traits without building message trees.
+//
+
+#ifndef SIO_VALUE_H
+#define SIO_VALUE_H
+#include "sio_message.h"
+#include "sio_typed.h"
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sio
+{
+    class value
+    {
+    public:
+        struct member;
+
+        //null.
+        value():
+            m_flag(message::flag_null)
+        {
+        }
+
+        value(bool b):
+            m_flag(message::flag_boolean)
+        {
+            m_bool = b;
+        }
+
+        template<typename T>
+        value(T i,typename std::enable_if<std::is_integral<T>::value && !std::is_same<T,bool>::value>::type* = 0):
+            m_flag(message::flag_integer)
+        {
+            m_int = static_cast<int64_t>(i);
+        }
+
+        value(double d):
+            m_flag(message::flag_double)
+        {
+            m_double = d;
+        }
+
+        value(const char* str):
+            m_flag(message::flag_string)
+        {
+            new(&m_string) std::string(str);
+        }
+
+        value(std::string const& str):
+            m_flag(message::flag_string)
+        {
+            new(&m_string) std::string(str);
+        }
+
+        value(std::string&& str):
+            m_flag(message::flag_string)
+        {
+            new(&m_string) std::string(std::move(str));
+        }
+
+        //sent as a binary attachment, a null pointer makes a null value.
+        value(std::shared_ptr<const std::string> const& binary):
+            m_flag(binary ? message::flag_binary : message::flag_null)
+        {
+            if(binary)
+            {
+                new(&m_binary) std::shared_ptr<const std::string>(binary);
+            }
+        }
+
+        static value array()
+        {
+            value v;
+            v.reset(message::flag_array);
+            return v;
+        }
+
+        static value object()
+        {
+            value v;
+            v.reset(message::flag_object);
+            return v;
+        }
+
+        value(value const& other):
+            m_flag(message::flag_null)
+        {
+            copy_from(other);
+        }
+
+        value(value&& other):
+            m_flag(message::flag_null)
+        {
+            move_from(std::move(other));
+        }
+
+        value& operator=(value const& other)
+        {
+            if(this != &other)
+            {
+                value copy(other);
+                destroy();
+                move_from(std::move(copy));
+            }
+            return *this;
+        }
+
+        value& operator=(value&& other)
+        {
+            if(this != &other)
+            {
+                destroy();
+                move_from(std::move(other));
+            }
+            return *this;
+        }
+
+        ~value()
+        {
+            destroy();
+        }
+
+        message::flag get_flag() const
+        {
+            return m_flag;
+        }
+
+        bool is_null() const
+        {
+            return m_flag == message::flag_null;
+        }
+
+        bool get_bool() const
+        {
+            assert(m_flag == message::flag_boolean);
+            return m_flag == message::flag_boolean && m_bool;
+        }
+
+        int64_t get_int() const
+        {
+            assert(m_flag == message::flag_integer);
+            return m_flag == message::flag_integer ? m_int : 0;
+        }
+
+        //integers are converted, as with message::get_double.
+        double get_double() const
+        {
+            assert(m_flag == message::flag_double || m_flag == message::flag_integer);
+            return m_flag == message::flag_double ? m_double : (m_flag == message::flag_integer ? static_cast<double>(m_int) : 0);
+        }
+
+        std::string const& get_string() const
+        {
+            assert(m_flag == message::flag_string);
+            return m_flag == message::flag_string ? m_string : empty<std::string>();
+        }
+
+        std::shared_ptr<const std::string> const& get_binary() const
+        {
+            assert(m_flag == message::flag_binary);
+            return m_flag == message::flag_binary ? m_binary : empty<std::shared_ptr<const std::string> >();
+        }
+
+        std::vector<value> const& get_vector() const
+        {
+            assert(m_flag == message::flag_array);
+            return m_flag == message::flag_array ? *m_array : empty<std::vector<value> >();
+        }
+
+        //a null value becomes an array first, as with push. Any other kind asserts, and is
+        //replaced by an empty array in release builds.
+        std::vector<value>& get_vector()
+        {
+            assert(m_flag == message::flag_array || m_flag == message::flag_null);
+            if(m_flag != message::flag_array)
+            {
+                reset(message::flag_array);
+            }
+            return *m_array;
+        }
+
+        //members in the order they were added or received.
+        std::vector<member> const& get_members() const
+        {
+            assert(m_flag == message::flag_object);
+            return m_flag == message::flag_object ? *m_object : empty<std::vector<member> >();
+        }
+
+        //a null value becomes an object first, as with operator[](key).
+        std::vector<member>& get_members()
+        {
+            assert(m_flag == message::flag_object || m_flag == message::flag_null);
+            if(m_flag != message::flag_object)
+            {
+                reset(message::flag_object);
+            }
+            return *m_object;
+        }
+
+        //first member named key, null if there is none or this is not an object.
+        value const* find(std::string const& key) const;
+
+        value* find(std::string const& key)
+        {
+            return const_cast<value*>(static_cast<value const*>(this)->find(key));
+        }
+
+        //the member named key, added as null if missing. A null value becomes an object first.
+        value& operator[](std::string const& key);
+
+        value const& operator[](size_t i) const
+        {
+            return get_vector()[i];
+        }
+
+        value& operator[](size_t i)
+        {
+            return get_vector()[i];
+        }
+
+        //appends to an array, a null value becomes an array first.
+        void push(value v)
+        {
+            if(m_flag == message::flag_null)
+            {
+                reset(message::flag_array);
+            }
+            get_vector().push_back(std::move(v));
+        }
+
+        //elements of an array, members of an object, 0 otherwise.
+        size_t size() const;
+
+        bool operator==(value const& other) const;
+
+        bool operator!=(value const& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        //returned by the const getters when the kind does not match, never modified.
+        template<typename T>
+        static T const& empty()
+        {
+            static const T s_empty = T();
+            return s_empty;
+        }
+
+        typedef std::unique_ptr<std::vector<value> > array_ptr;
+
+        typedef std::unique_ptr<std::vector<member> > object_ptr;
+
+        void reset(message::flag f);
+
+        void destroy();
+
+        void copy_from(value const& other);
+
+        //leaves other null.
+        void move_from(value&& other);
+
+        message::flag m_flag;
+        union
+        {
+            bool m_bool;
+            int64_t m_int;
+            double m_double;
+            std::string m_string;//short strings stay inline.
+            std::shared_ptr<const std::string> m_binary;
+            //behind pointers, value and member are still incomplete here.
+            array_ptr m_array;
+            object_ptr m_object;
+        };
+
+        friend struct json_traits<value>;
+    };
+
+    struct value::member
+    {
+        member()
+        {
+        }
+
+        member(std::string k,value v):
+            key(std::move(k)),
+            val(std::move(v))
+        {
+        }
+
+        std::string key;
+        value val;
+    };
+
+    inline void value::reset(message::flag f)
+    {
+        destroy();
+        switch(f)
+        {
+        case message::flag_string:
+            new(&m_string) std::string();
+            break;
+        case message::flag_binary:
+            new(&m_binary) std::shared_ptr<const std::string>();
+            break;
+        case message::flag_array:
+            new(&m_array) array_ptr(new std::vector<value>());
+            break;
+        case message::flag_object:
+            new(&m_object) object_ptr(new std::vector<member>());
+            break;
+        default:
+            m_int = 0;
+            break;
+        }
+        m_flag = f;
+    }
+
+    inline void value::destroy()
+    {
+        switch(m_flag)
+        {
+        case message::flag_string:
+            m_string.~basic_string();
+            break;
+        case message::flag_binary:
+            m_binary.~shared_ptr();
+            break;
+        case message::flag_array:
+            m_array.~array_ptr();
+            break;
+        case message::flag_object:
+            m_object.~object_ptr();
+            break;
+        default:
+            break;
+        }
+        m_flag = message::flag_null;
+    }
+
+    inline void value::copy_from(value const& other)
+    {
+        switch(other.m_flag)
+        {
+        case message::flag_string:
+            new(&m_string) std::string(other.m_string);
+            break;
+        case message::flag_binary:
+            new(&m_binary) std::shared_ptr<const std::string>(other.m_binary);
+            break;
+        case message::flag_array:
+            new(&m_array) array_ptr(new std::vector<value>(*other.m_array));
+            break;
+        case message::flag_object:
+            new(&m_object) object_ptr(new std::vector<member>(*other.m_object));
+            break;
+        case message::flag_double:
+            m_double = other.m_double;
+            break;
+        case message::flag_boolean:
+            m_bool = other.m_bool;
+            break;
+        default:
+            m_int = other.m_int;
+            break;
+        }
+        m_flag = other.m_flag;
+    }
+
+    //leaves other null.
+    inline void value::move_from(value&& other)
+    {
+        switch(other.m_flag)
+        {
+        case message::flag_string:
+            new(&m_string) std::string(std::move(other.m_string));
+            break;
+        case message::flag_binary:
+            new(&m_binary) std::shared_ptr<const std::string>(std::move(other.m_binary));
+            break;
+        case message::flag_array:
+            new(&m_array) array_ptr(std::move(other.m_array));
+            break;
+        case message::flag_object:
+            new(&m_object) object_ptr(std::move(other.m_object));
+            break;
+        case message::flag_double:
+            m_double = other.m_double;
+            break;
+        case message::flag_boolean:
+            m_bool = other.m_bool;
+            break;
+        default:
+            m_int = other.m_int;
+            break;
+        }
+        m_flag = other.m_flag;
+        other.destroy();
+    }
+
+    inline size_t value::size() const
+    {
+        return m_flag == message::flag_array ? m_array->size() : (m_flag == message::flag_object ? m_object->size() : 0);
+    }
+
+    inline value const* value::find(std::string const& key) const
+    {
+        if(m_flag != message::flag_object)
+        {
+            return nullptr;
+        }
+        for(auto it = m_object->begin();it!=m_object->end();++it)
+        {
+            if(it->key == key)
+            {
+                return &it->val;
+            }
+        }
+        return nullptr;
+    }
+
+    inline value& value::operator[](std::string const& key)
+    {
+        if(m_flag == message::flag_null)
+        {
+            reset(message::flag_object);
+        }
+        value* found = find(key);
+        if(found)
+        {
+            return *found;
+        }
+        std::vector<member>& members = get_members();
+        members.push_back(member(key,value()));
+        return members.back().val;
+    }
+
+    inline bool value::operator==(value const& other) const
+    {
+        if(m_flag != other.m_flag)
+        {
+            return false;
+        }
+        switch(m_flag)
+        {
+        case message::flag_null:
+            return true;
+        case message::flag_boolean:
+            return m_bool == other.m_bool;
+        case message::flag_integer:
+            return m_int == other.m_int;
+        case message::flag_double:
+            return m_double == other.m_double;
+        case message::flag_string:
+            return m_string == other.m_string;
+        case message::flag_binary:
+            return m_binary == other.m_binary || (m_binary && other.m_binary && *m_binary == *other.m_binary);
+        case message::flag_array:
+            return *m_array == *other.m_array;
+        case message::flag_object:
+            if(m_object->size() != other.m_object->size())
+            {
+                return false;
+            }
+            std::vector<member> const& members = *m_object;
+            std::vector<member> const& other_members = *other.m_object;
+            for(size_t i = 0;i < members.size();++i)
+            {
+                if(members[i].key != other_members[i].key || members[i].val != other_members[i].val)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    //any json value, read and written without going through message trees.
+    template<>
+    struct json_traits<value>
+    {
+        static bool read_null(void* target)
+        {
+            *static_cast<value*>(target) = value();
+            return true;
+        }
+
+        static bool read_bool(void* target,bool b)
+        {
+            *static_cast<value*>(target) = value(b);
+            return true;
+        }
+
+        static bool read_int(void* target,int64_t i)
+        {
+            *static_cast<value*>(target) = value(i);
+            return true;
+        }
+
+        static bool read_double(void* target,double d)
+        {
+            *static_cast<value*>(target) = value(d);
+            return true;
+        }
+
+        static bool read_string(void* target,const char* str,size_t length)
+        {
+            *static_cast<value*>(target) = value(std::string(str,length));
+            return true;
+        }
+
+        static bool read_binary(void* target,std::shared_ptr<const std::string> const& data)
+        {
+            *static_cast<value*>(target) = value(data);
+            return true;
+        }
+
+        static bool start_object(void* target)
+        {
+            static_cast<value*>(target)->reset(message::flag_object);
+            return true;
+        }
+
+        //duplicate keys are kept, find returns the first.
+        static bool field(void* target,const char* key,size_t length,void** member,json_read_ops const** member_ops)
+        {
+            std::vector<value::member>& members = *static_cast<value*>(target)->m_object;
+            members.push_back(value::member(std::string(key,length),value()));
+            *member = &members.back().val;
+            *member_ops = &read_ops();
+            return true;
+        }
+
+        static bool start_array(void* target)
+        {
+            static_cast<value*>(target)->reset(message::flag_array);
+            return true;
+        }
+
+        static void* element(void* target,json_read_ops const** element_ops)
+        {
+            std::vector<value>& elements = *static_cast<value*>(target)->m_array;
+            elements.push_back(value());
+            *element_ops = &read_ops();
+            return &elements.back();
+        }
+
+        static void write(value const& v,json_handler& out)
+        {
+            switch(v.m_flag)
+            {
+            case message::flag_boolean:
+                out.bool_value(v.m_bool);
+                break;
+            case message::flag_integer:
+                out.int_value(v.m_int);
+                break;
+            case message::flag_double:
+                out.double_value(v.m_double);
+                break;
+            case message::flag_string:
+                out.string_value(v.m_string.data(),v.m_string.size());
+                break;
+            case message::flag_binary:
+                out.binary_value(v.m_binary);
+                break;
+            case message::flag_array:
+                out.start_array();
+                for(auto it = v.m_array->begin();it!=v.m_array->end();++it)
+                {
+                    write(*it,out);
+                }
+                out.end_array();
+                break;
+            case message::flag_object:
+                out.start_object();
+                for(auto it = v.m_object->begin();it!=v.m_object->end();++it)
+                {
+                    out.key(it->key.data(),it->key.size());
+                    write(it->val,out);
+                }
+                out.end_object();
+                break;
+            default:
+                out.null_value();
+                break;
+            }
+        }
+
+        static json_read_ops const& read_ops()
+        {
+            static const json_read_ops ops = { &read_bool, &read_int, &read_double, &read_string, &read_binary, &start_object, &field, &start_array, &element, &read_null, nullptr };
+            return ops;
+        }
+    };
+}
+
+#endif // SIO_VALUE_H
@@ -0,0 +1,741 @@
+//
+//  sio_benchmark.cpp
+//
+//  Micro-benchmarks for the packet encode/decode paths.
+//  Run ./sio_benchmark (optionally with a tag filter such as "[encode]").
+//
+
+#include <sio_client.h>
+#include <internal/sio_packet.h>
+#include <internal/sio_mpsc_queue.h>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+using namespace sio;
+
+namespace
+{
+    std::atomic<size_t> g_allocations(0);
+}
+
+//Count every heap allocation so the benchmarks can report allocations per event.
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    template <typename F>
+    double allocations_per_call(F const& func, size_t iterations = 1000)
+    {
+        func();//warm up pooled state.
+        size_t before = g_allocations.load();
+        for (size_t i = 0; i < iterations; ++i)
+        {
+            func();
+        }
+        return double(g_allocations.load() - before) / iterations;
+    }
+
+    //The DOM based encoder packet::accept used before it streamed into the writer,
+    //kept here as the baseline.
+    void legacy_accept_message(message const& msg, rapidjson::Value& val, rapidjson::Document& doc, std::vector<std::shared_ptr<const std::string> >& buffers)
+    {
+        switch(msg.get_flag())
+        {
+        case message::flag_integer:
+            val.SetInt64(msg.get_int());
+            break;
+        case message::flag_double:
+            val.SetDouble(msg.get_double());
+            break;
+        case message::flag_string:
+            val.SetString(msg.get_string().data(), (rapidjson::SizeType)msg.get_string().length());
+            break;
+        case message::flag_boolean:
+            val.SetBool(msg.get_bool());
+            break;
+        case message::flag_null:
+            val.SetNull();
+            break;
+        case message::flag_binary:
+        {
+            val.SetObject();
+            rapidjson::Value boolVal(true);
+            val.AddMember("_placeholder", boolVal, doc.GetAllocator());
+            rapidjson::Value numVal((int)buffers.size());
+            val.AddMember("num", numVal, doc.GetAllocator());
+            buffers.push_back(msg.get_binary());
+            break;
+        }
+        case message::flag_array:
+        {
+            val.SetArray();
+            for (auto it = msg.get_vector().begin(); it != msg.get_vector().end(); ++it)
+            {
+                rapidjson::Value child;
+                legacy_accept_message(*(*it), child, doc, buffers);
+                val.PushBack(child, doc.GetAllocator());
+            }
+            break;
+        }
+        case message::flag_object:
+        {
+            val.SetObject();
+            for (auto it = msg.get_map().begin(); it != msg.get_map().end(); ++it)
+            {
+                rapidjson::Value nameVal;
+                nameVal.SetString(it->first.data(), (rapidjson::SizeType)it->first.length(), doc.GetAllocator());
+                rapidjson::Value valueVal;
+                legacy_accept_message(*(it->second), valueVal, doc, buffers);
+                val.AddMember(nameVal, valueVal, doc.GetAllocator());
+            }
+            break;
+        }
+        }
+    }
+
+    std::string legacy_encode(message::ptr const& msg, std::vector<std::shared_ptr<const std::string> >& buffers, int pack_id = -1)
+    {
+        rapidjson::Document doc;
+        legacy_accept_message(*msg, doc, doc, buffers);
+        std::ostringstream ss;
+        ss.precision(8);
+        ss << packet::frame_message << (buffers.empty() ? packet::type_event : packet::type_binary_event);
+        if (!buffers.empty())
+        {
+            ss << buffers.size() << "-";
+        }
+        ss << "/bench,";
+        if (pack_id >= 0)
+        {
+            ss << pack_id;
+        }
+        rapidjson::StringBuffer buffer;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        doc.Accept(writer);
+        std::string payload = ss.str();
+        payload.append(buffer.GetString(), buffer.GetSize());
+        return payload;
+    }
+
+    std::string encode(message::ptr const& msg, std::vector<std::shared_ptr<const std::string> >& buffers, int pack_id = -1)
+    {
+        packet p("/bench", msg, pack_id);
+        std::string payload;
+        p.accept(payload, buffers);
+        return payload;
+    }
+
+    //A typical telemetry style event: a name plus one object with mixed fields.
+    message::ptr make_event()
+    {
+        message::ptr obj = object_message::create();
+        obj->get_map()["id"] = int_message::create(123456789);
+        obj->get_map()["ratio"] = double_message::create(0.75);
+        obj->get_map()["active"] = bool_message::create(true);
+        obj->get_map()["owner"] = null_message::create();
+        obj->get_map()["name"] = string_message::create("sensor-7/temperature");
+        message::ptr samples = array_message::create();
+        for (int i = 0; i < 16; ++i)
+        {
+            samples->get_vector().push_back(int_message::create(i * 3));
+        }
+        obj->get_map()["samples"] = samples;
+        message::list args(obj);
+        return args.to_array_message("telemetry");
+    }
+
+    //Small events are dominated by the header cost.
+    message::ptr make_small_event()
+    {
+        message::list args(int_message::create(1));
+        return args.to_array_message("tick");
+    }
+
+    message::ptr make_binary_event()
+    {
+        message::ptr obj = object_message::create();
+        obj->get_map()["desc"] = string_message::create("chunk");
+        obj->get_map()["data"] = binary_message::create(std::make_shared<const std::string>(4096, 'x'));
+        message::list args(obj);
+        return args.to_array_message("upload");
+    }
+
+    //Text frames as they arrive from a string heavy feed: chat lines, quote updates with
+    //escaped text, acks and a larger listing.
+    std::vector<std::string> make_decode_corpus()
+    {
+        std::vector<std::string> corpus;
+        corpus.push_back("42[\"chat\",{\"user\":\"melo\",\"room\":\"general\",\"text\":\"hello everyone, \\\"quoted\\\" and \\u00e9scaped\"}]");
+        corpus.push_back("42/feed,[\"quote\",{\"symbol\":\"ACME\",\"venue\":\"XNAS\",\"bid\":101.25,\"ask\":101.5,\"note\":\"halted\\nresumed\"}]");
+        corpus.push_back("43/feed,1204[{\"status\":\"ok\",\"message\":\"subscribed to 12 symbols\"}]");
+        std::ostringstream listing;
+        listing << "42/feed,[\"listing\",[";
+        for(int i = 0; i < 200; ++i)
+        {
+            listing << (i ? "," : "") << "{\"id\":\"item-" << i << "\",\"title\":\"Item number " << i << " in the listing\",\"tags\":[\"alpha\",\"beta\"]}";
+        }
+        listing << "]]";
+        corpus.push_back(listing.str());
+        return corpus;
+    }
+
+    //The mutex guarded std::queue socket::impl drained before every send, kept as the baseline.
+    class locked_packet_queue
+    {
+    public:
+        void push(encoded_packet&& p)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_queue.push(std::move(p));
+        }
+
+        bool pop(encoded_packet& out)
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            if(m_queue.empty())
+            {
+                return false;
+            }
+            out = std::move(m_queue.front());
+            m_queue.pop();
+            return true;
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::queue<encoded_packet> m_queue;
+    };
+
+    //producers emit concurrently into one queue while a single consumer drains it, as the
+    //network thread does. Like socket::emit, each producer encodes before it pushes.
+    //Returns the number of packets drained.
+    template <typename Queue>
+    size_t emit_concurrently(Queue& queue, message::ptr const& msg, unsigned producers, size_t per_producer)
+    {
+        packet_manager manager;
+        size_t total = producers * per_producer;
+        size_t drained = 0;
+        std::thread consumer([&]()
+        {
+            encoded_packet encoded;
+            while(drained < total)
+            {
+                if(queue.pop(encoded))
+                {
+                    ++drained;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        std::vector<std::thread> threads;
+        for(unsigned i = 0; i < producers; ++i)
+        {
+            threads.push_back(std::thread([&]()
+            {
+                for(size_t n = 0; n < per_producer; ++n)
+                {
+                    packet p("/bench", msg);
+                    encoded_packet encoded;
+                    manager.encode(p, [&encoded](bool isBinary, std::shared_ptr<const std::string> const& payload)
+                    {
+                        encoded.frames.push_back(packet_manager::encoded_frame(isBinary, payload));
+                    });
+                    queue.push(std::move(encoded));
+                }
+            }));
+        }
+        for(auto& t : threads)
+        {
+            t.join();
+        }
+        consumer.join();
+        return drained;
+    }
+}
+
+TEST_CASE( "benchmark_encode_event", "[.][benchmark][encode]" )
+{
+    message::ptr msg = make_event();
+    {
+        std::vector<std::shared_ptr<const std::string> > legacy_buffers, buffers;
+        std::string legacy = legacy_encode(msg, legacy_buffers);
+        std::string current = encode(msg, buffers);
+        REQUIRE(legacy == current);
+    }
+
+    BENCHMARK("dom accept_message")
+    {
+        std::vector<std::shared_ptr<const std::string> > buffers;
+        return legacy_encode(msg, buffers);
+    };
+
+    BENCHMARK("streaming accept_message")
+    {
+        std::vector<std::shared_ptr<const std::string> > buffers;
+        return encode(msg, buffers);
+    };
+}
+
+TEST_CASE( "benchmark_encode_small_event", "[.][benchmark][encode]" )
+{
+    message::ptr msg = make_small_event();
+    {
+        std::vector<std::shared_ptr<const std::string> > legacy_buffers, buffers;
+        REQUIRE(legacy_encode(msg, legacy_buffers, 4711) == encode(msg, buffers, 4711));
+    }
+
+    BENCHMARK("ostringstream header")
+    {
+        std::vector<std::shared_ptr<const std::string> > buffers;
+        return legacy_encode(msg, buffers, 4711);
+    };
+
+    BENCHMARK("sized header")
+    {
+        std::vector<std::shared_ptr<const std::string> > buffers;
+        return encode(msg, buffers, 4711);
+    };
+}
+
+TEST_CASE( "benchmark_encode_binary_event", "[.][benchmark][encode]" )
+{
+    message::ptr msg = make_binary_event();
+
+    BENCHMARK("dom accept_message")
+    {
+        std::vector<std::shared_ptr<const std::string> > buffers;
+        return legacy_encode(msg, buffers);
+    };
+
+    BENCHMARK("streaming accept_message")
+    {
+        std::vector<std::shared_ptr<const std::string> > buffers;
+        return encode(msg, buffers);
+    };
+}
+
+TEST_CASE( "benchmark_encode_packet_manager", "[.][benchmark][encode]" )
+{
+    message::ptr msg = make_event();
+    packet_manager manager;
+    size_t bytes = 0;
+    packet_manager::encode_callback_function sink = [&](bool, std::shared_ptr<const std::string> const& payload)
+    {
+        bytes += payload->size();
+    };
+
+    std::cout << "allocations per event, dom accept_message: " << allocations_per_call([&]()
+    {
+        std::vector<std::shared_ptr<const std::string> > buffers;
+        legacy_encode(msg, buffers);
+    }) << std::endl;
+    std::cout << "allocations per event, packet_manager::encode: " << allocations_per_call([&]()
+    {
+        packet p("/bench", msg);
+        manager.encode(p, sink);
+    }) << std::endl;
+
+    BENCHMARK("packet_manager::encode")
+    {
+        packet p("/bench", msg);
+        manager.encode(p, sink);
+        return bytes;
+    };
+}
+
+TEST_CASE( "benchmark_encode_prepared_event", "[.][benchmark][encode]" )
+{
+    message::list args(int_message::create(1));
+    args.push(std::string("label"));
+    std::shared_ptr<const std::string> prefix = packet::encode_event_prefix("tick");
+    packet_manager manager;
+    size_t bytes = 0;
+    packet_manager::encode_callback_function sink = [&](bool, std::shared_ptr<const std::string> const& payload)
+    {
+        bytes += payload->size();
+    };
+
+    BENCHMARK("to_array_message(name)")
+    {
+        packet p("/bench", args.to_array_message("tick"));
+        manager.encode(p, sink);
+        return bytes;
+    };
+
+    BENCHMARK("prepared event")
+    {
+        packet p("/bench", prefix, args.to_array_message());
+        manager.encode(p, sink);
+        return bytes;
+    };
+}
+
+TEST_CASE( "benchmark_emit_producers", "[.][benchmark][emit]" )
+{
+    message::ptr msg = make_small_event();
+    const size_t per_producer = 10000;
+    unsigned counts[] = { 1, 2, 4, 8, 16 };
+    for(unsigned producers : counts)
+    {
+        BENCHMARK("mutex + std::queue, " + std::to_string(producers) + " producers")
+        {
+            locked_packet_queue queue;
+            return emit_concurrently(queue, msg, producers, per_producer);
+        };
+
+        BENCHMARK("mpsc_queue, " + std::to_string(producers) + " producers")
+        {
+            mpsc_queue<encoded_packet> queue;
+            return emit_concurrently(queue, msg, producers, per_producer);
+        };
+    }
+}
+
+namespace
+{
+    //The substr/stoul/stoi header parser packet::parse used before read_header, kept as the baseline.
+    size_t legacy_parse_header(std::string const& payload_ptr, std::string& nsp, int& pack_id, unsigned& attachments)
+    {
+        size_t pos = 2;
+        attachments = 0;
+        pack_id = -1;
+        int type = payload_ptr[1] - '0';
+        if (type == packet::type_binary_event || type == packet::type_binary_ack) {
+            size_t score_pos = payload_ptr.find('-');
+            attachments = static_cast<unsigned>(std::stoul(payload_ptr.substr(pos, score_pos - pos)));
+            pos = score_pos+1;
+        }
+        size_t json_pos = payload_ptr.find_first_of("{[\"/",pos,4);
+        if(json_pos == std::string::npos)
+        {
+            nsp = "/";
+            return std::string::npos;
+        }
+        if(payload_ptr[json_pos] == '/')
+        {
+            size_t comma_pos = payload_ptr.find_first_of(",");
+            if(comma_pos == std::string::npos)
+            {
+                nsp = payload_ptr.substr(json_pos);
+                return std::string::npos;
+            }
+            nsp = payload_ptr.substr(json_pos,comma_pos - json_pos);
+            pos = comma_pos+1;
+            json_pos = payload_ptr.find_first_of("\"[{", pos, 3);
+            if(json_pos == std::string::npos)
+            {
+                return std::string::npos;
+            }
+        }
+        else
+        {
+            nsp = "/";
+        }
+        if(pos<json_pos)
+        {
+            std::string pack_id_str = payload_ptr.substr(pos, json_pos - pos);
+            if (std::all_of(pack_id_str.begin(), pack_id_str.end(), ::isdigit)) {
+                pack_id = std::stoi(pack_id_str);
+            }
+        }
+        return json_pos;
+    }
+
+    std::vector<std::string> make_header_corpus()
+    {
+        std::vector<std::string> corpus;
+        corpus.push_back("42[\"chat\",\"hi\"]");
+        corpus.push_back("42/rooms/lobby,[\"chat\",\"hi\"]");
+        corpus.push_back("42/rooms/lobby,1234[\"chat\",\"hi\"]");
+        corpus.push_back("4398765[\"ok\"]");
+        corpus.push_back("452-/uploads,77[\"file\",{\"_placeholder\":true,\"num\":0}]");
+        return corpus;
+    }
+}
+
+TEST_CASE( "benchmark_parse_header", "[.][benchmark][decode]" )
+{
+    std::vector<std::string> corpus = make_header_corpus();
+    for(auto const& frame : corpus)
+    {
+        std::string nsp;
+        int pack_id;
+        unsigned attachments;
+        packet::header h;
+        REQUIRE(legacy_parse_header(frame, nsp, pack_id, attachments) == packet::read_header(frame.data(), frame.size(), h));
+        CHECK(nsp == (h.nsp ? std::string(h.nsp, h.nsp_length) : std::string("/")));
+        CHECK(pack_id == h.pack_id);
+        CHECK(attachments == h.attachments);
+    }
+    std::cout << "header allocations per packet, substr/stoi: " << allocations_per_call([&]
+    {
+        std::string nsp;
+        int pack_id;
+        unsigned attachments;
+        legacy_parse_header(corpus[4], nsp, pack_id, attachments);
+    }) << ", read_header: " << allocations_per_call([&]
+    {
+        packet::header h;
+        packet::read_header(corpus[4].data(), corpus[4].size(), h);
+    }) << std::endl;
+
+    //divide by the corpus size for ns per header.
+    BENCHMARK("substr/stoi header, " + std::to_string(corpus.size()) + " packets")
+    {
+        size_t sum = 0;
+        std::string nsp;
+        int pack_id;
+        unsigned attachments;
+        for(auto const& frame : corpus)
+        {
+            sum += legacy_parse_header(frame, nsp, pack_id, attachments) + pack_id;
+        }
+        return sum;
+    };
+
+    BENCHMARK("read_header, " + std::to_string(corpus.size()) + " packets")
+    {
+        size_t sum = 0;
+        packet::header h;
+        for(auto const& frame : corpus)
+        {
+            sum += packet::read_header(frame.data(), frame.size(), h) + h.pack_id;
+        }
+        return sum;
+    };
+}
+
+TEST_CASE( "benchmark_decode_corpus", "[.][benchmark][decode]" )
+{
+    std::vector<std::string> corpus = make_decode_corpus();
+
+    BENCHMARK("parse(string const&)")
+    {
+        size_t count = 0;
+        for(auto const& frame : corpus)
+        {
+            packet p;
+            p.parse(frame);
+            count += p.get_message() ? 1 : 0;
+        }
+        return count;
+    };
+
+    //the copy stands in for the websocketpp buffer that on_message hands over.
+    BENCHMARK("parse(string&&) in situ")
+    {
+        size_t count = 0;
+        for(auto const& frame : corpus)
+        {
+            packet p;
+            p.parse(std::string(frame));
+            count += p.get_message() ? 1 : 0;
+        }
+        return count;
+    };
+}
+
+TEST_CASE( "benchmark_decode_arena", "[.][benchmark][decode]" )
+{
+    std::vector<std::string> corpus = make_decode_corpus();
+    auto decode = [&](bool arena)
+    {
+        size_t count = 0;
+        for(auto const& frame : corpus)
+        {
+            packet p;
+            p.set_arena_decode(arena);
+            p.parse(std::string(frame));
+            count += p.get_message() ? 1 : 0;
+        }
+        return count;
+    };
+    std::cout << "allocations per corpus, heap nodes: " << allocations_per_call([&]
+    {
+        decode(false);
+    }, 100) << ", arena nodes: " << allocations_per_call([&]
+    {
+        decode(true);
+    }, 100) << std::endl;
+
+    BENCHMARK("heap nodes")
+    {
+        return decode(false);
+    };
+
+    BENCHMARK("arena nodes")
+    {
+        return decode(true);
+    };
+}
+
+//Build with -DINTRUSIVE_MESSAGE_PTR=ON (and SINGLE_THREADED_MESSAGES) to compare handle types.
+TEST_CASE( "benchmark_message_ptr_copy", "[.][benchmark][message]" )
+{
+    message::list args;
+    for(int i = 0; i < 8; ++i)
+    {
+        args.push(int_message::create(i));
+    }
+    std::cout << "allocations per to_array_message: " << allocations_per_call([&]
+    {
+        args.to_array_message("event");
+    }) << std::endl;
+
+    BENCHMARK("copy message::list")
+    {
+        message::list copy(args);
+        return copy.size();
+    };
+
+    BENCHMARK("to_array_message")
+    {
+        return args.to_array_message("event");
+    };
+}
+
+TEST_CASE( "benchmark_decode_telemetry", "[.][benchmark][decode]" )
+{
+    //the same events twice, flags and counters in the shared range and then shifted out of it.
+    auto make_telemetry = [](int64_t shift)
+    {
+        std::ostringstream frame;
+        frame << "42/metrics,[\"telemetry\",{\"seq\":" << 9 + shift << ",\"flags\":[";
+        for(int i = 0; i < 16; ++i)
+        {
+            frame << (i ? "," : "");
+            if(shift)
+            {
+                frame << i + shift;
+            }
+            else
+            {
+                frame << (i % 3 ? "true" : "false");
+            }
+        }
+        frame << "],\"counters\":{\"retries\":" << 2 + shift << ",\"drops\":" << 0 + shift << ",\"queued\":" << 17 + shift << "},\"error\":" << (shift ? std::to_string(shift) : std::string("null")) << "}]";
+        return frame.str();
+    };
+    std::string shared = make_telemetry(0);
+    std::string allocated = make_telemetry(1000000);
+    auto decode = [](std::string const& frame)
+    {
+        packet p;
+        p.parse(std::string(frame));
+        return p.get_message() ? 1 : 0;
+    };
+    std::cout << "allocations per telemetry event, shared scalars: " << allocations_per_call([&]
+    {
+        decode(shared);
+    }) << ", allocated scalars: " << allocations_per_call([&]
+    {
+        decode(allocated);
+    }) << std::endl;
+
+    BENCHMARK("shared scalars")
+    {
+        return decode(shared);
+    };
+
+    BENCHMARK("allocated scalars")
+    {
+        return decode(allocated);
+    };
+}
+
+TEST_CASE( "benchmark_decode_value", "[.][benchmark][decode]" )
+{
+    //deep and wide: rows of objects holding arrays of objects.
+    std::ostringstream frame;
+    frame << "42[\"table\",[";
+    for(int row = 0; row < 100; ++row)
+    {
+        frame << (row ? "," : "") << "{\"row\":" << row << ",\"label\":\"r" << row << "\",\"cells\":[";
+        for(int cell = 0; cell < 10; ++cell)
+        {
+            frame << (cell ? "," : "") << "{\"v\":" << row * cell + 0.5 << ",\"ok\":" << (cell % 2 ? "true" : "false") << "}";
+        }
+        frame << "]}";
+    }
+    frame << "]]";
+    std::string json = frame.str();
+
+    std::cout << "allocations per event, message tree: " << allocations_per_call([&]
+    {
+        packet p;
+        p.parse(std::string(json));
+    }, 100) << ", sio::value: " << allocations_per_call([&]
+    {
+        packet p;
+        p.parse(std::string(json), true);
+        value v;
+        from_message(p.get_message()->get_vector()[1], v);
+    }, 100) << std::endl;
+
+    BENCHMARK("decode and walk message tree")
+    {
+        packet p;
+        p.parse(std::string(json));
+        double sum = 0;
+        for(auto const& row : p.get_message()->get_vector()[1]->get_vector())
+        {
+            for(auto const& cell : row->get_map().at("cells")->get_vector())
+            {
+                sum += cell->get_map().at("v")->get_double();
+            }
+        }
+        return sum;
+    };
+
+    BENCHMARK("decode and walk sio::value")
+    {
+        packet p;
+        p.parse(std::string(json), true);
+        value v;
+        from_message(p.get_message()->get_vector()[1], v);
+        double sum = 0;
+        for(auto const& row : v.get_vector())
+        {
+            for(auto const& cell : row.find("cells")->get_vector())
+            {
+                sum += cell.find("v")->get_double();
+            }
+        }
+        return sum;
+    };
+}
@@ -6,8 +6,17 @@
 
 #include <sio_client.h>
 #include <internal/sio_packet.h>
+#include <internal/sio_mpsc_queue.h>
+#include <internal/sio_frame_buffer.h>
+#include <internal/sio_client_impl.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <new>
 #include <thread>
 
 #include <catch2/catch_test_macros.hpp>
@@ -18,6 +27,40 @@
 
 using namespace sio;
 
+namespace
+{
+    std::atomic<size_t> g_allocations(0);
+
+    template <typename F>
+    size_t count_allocations(F const& func)
+    {
+        size_t before = g_allocations.load();
+        func();
+        return g_allocations.load() - before;
+    }
+}
+
+//Counted so tests can pin down how many allocations a path makes.
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1))
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
 TEST_CASE( "test_packet_construct_1" )
 {
     packet p("/nsp",nullptr,1001,true);
@@ -130,6 +173,295 @@ TEST_CASE( "test_packet_accept_4" )
 }
 #endif
 
+TEST_CASE( "test_packet_accept_5" )
+{
+    message::ptr obj = object_message::create();
+    obj->get_map()["int"] = int_message::create(-42);
+    obj->get_map()["double"] = double_message::create(0.5);
+    obj->get_map()["bool"] = bool_message::create(false);
+    obj->get_map()["null"] = null_message::create();
+    message::ptr nested = array_message::create();
+    nested->get_vector().push_back(string_message::create("a\"b"));
+    nested->get_vector().push_back(array_message::create());
+    nested->get_vector().push_back(object_message::create());
+    obj->get_map()["nested"] = nested;
+    message::list args(obj);
+    packet p("/",args.to_array_message("mixed"));
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    p.accept(payload,buffers);
+    CHECK(p.get_type() == packet::type_event);
+    CHECK(buffers.size() == 0);
+    CHECK(payload == "42[\"mixed\",{\"bool\":false,\"double\":0.5,\"int\":-42,\"nested\":[\"a\\\"b\",[],{}],\"null\":null}]");
+    INFO("outputing payload:" << payload);
+}
+
+TEST_CASE( "test_packet_accept_6" )
+{
+    packet p("/",message::list("text").to_array_message("event"),7,true);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    p.accept(payload,buffers);
+    CHECK(payload == "437[\"event\",\"text\"]");
+
+    packet p2("/nsp",nullptr,1234567,true);
+    std::string payload2;
+    p2.accept(payload2,buffers);
+    CHECK(payload2 == "43/nsp,1234567");
+}
+
+TEST_CASE( "test_packet_accept_prepared" )
+{
+    std::shared_ptr<const std::string> prefix = packet::encode_event_prefix("ev\"ent");
+    CHECK(*prefix == "[\"ev\\\"ent\"");
+    message::list args("text");
+    args.push(int_message::create(3));
+    packet p("/nsp",prefix,args.to_array_message(),5);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    p.accept(payload,buffers);
+    CHECK(p.get_type() == packet::type_event);
+    CHECK(payload == "42/nsp,5[\"ev\\\"ent\",\"text\",3]");
+
+    packet p2("/",prefix,message::list().to_array_message());
+    std::string payload2;
+    p2.accept(payload2,buffers);
+    CHECK(payload2 == "42[\"ev\\\"ent\"]");
+
+    packet p3("/",prefix,message::list(std::make_shared<const std::string>(10,'x')).to_array_message());
+    std::string payload3;
+    CHECK(p3.accept(payload3,buffers));
+    CHECK(p3.get_type() == packet::type_binary_event);
+    CHECK(buffers.size() == 1);
+    CHECK(payload3 == "451-[\"ev\\\"ent\",{\"_placeholder\":true,\"num\":0}]");
+}
+
+TEST_CASE( "test_packet_accept_raw" )
+{
+    std::shared_ptr<const std::string> prefix = packet::encode_event_prefix("event");
+    packet p("/nsp",prefix,std::make_shared<const std::string>("{\"a\":[1,2]}"),7);
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    CHECK(!p.accept(payload,buffers));
+    CHECK(p.get_type() == packet::type_event);
+    CHECK(payload == "42/nsp,7[\"event\",{\"a\":[1,2]}]");
+
+    packet p2("/",prefix,std::make_shared<const std::string>());
+    std::string payload2;
+    p2.accept(payload2,buffers);
+    CHECK(payload2 == "42[\"event\"]");
+
+    CHECK(packet::validate_json("{\"a\":[1,2]}"));
+    CHECK(packet::validate_json("\"text\""));
+    CHECK(!packet::validate_json("{\"a\":"));
+    CHECK(!packet::validate_json("1,2"));
+    CHECK(!packet::validate_json(""));
+}
+
+TEST_CASE( "test_packet_manager_encode_reuse" )
+{
+    packet_manager manager;
+    const std::string* first_payload = nullptr;
+    packet p1("/nsp",message::list("first").to_array_message("event"));
+    manager.encode(p1,[&](bool isBin,std::shared_ptr<const std::string> const& payload)
+    {
+        CHECK(!isBin);
+        CHECK(*payload == "42/nsp,[\"event\",\"first\"]");
+        first_payload = payload.get();
+    });
+    //the first payload is no longer referenced, so its buffer is handed out again.
+    packet p2("/nsp",message::list("second").to_array_message("event"));
+    manager.encode(p2,[&](bool isBin,std::shared_ptr<const std::string> const& payload)
+    {
+        CHECK(!isBin);
+        CHECK(*payload == "42/nsp,[\"event\",\"second\"]");
+        CHECK(payload.get() == first_payload);
+    });
+}
+
+TEST_CASE( "test_packet_is_larger_than" )
+{
+    message::ptr array = array_message::create();
+    for(int i = 0; i < 100; ++i)
+    {
+        array->get_vector().push_back(string_message::create("0123456789"));
+    }
+    packet p("/nsp",message::list(array).to_array_message("event"));
+    CHECK(p.is_larger_than(100));
+    CHECK(!p.is_larger_than(10000));
+    packet raw("/nsp",packet::encode_event_prefix("event"),std::make_shared<const std::string>(500,'1'));
+    CHECK(raw.is_larger_than(400));
+    CHECK(!raw.is_larger_than(1000));
+}
+
+TEST_CASE( "test_encode_pool" )
+{
+    message::ptr obj = object_message::create();
+    obj->get_map()["text"] = string_message::create("pooled");
+    obj->get_map()["data"] = binary_message::create(std::make_shared<const std::string>(10,'x'));
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::shared_ptr<encode_pool::job> job;
+    {
+        encode_pool pool(2);
+        job = std::make_shared<encode_pool::job>(packet("/nsp",message::list(obj).to_array_message("event"),7));
+        bool notified = false;
+        pool.submit(job,[&]()
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            notified = true;
+            cond.notify_one();
+        });
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock,[&](){ return notified; });
+    }
+    CHECK(job->done);
+    REQUIRE(job->frames.size() == 2);
+    CHECK(!job->frames[0].first);
+    CHECK(*job->frames[0].second == "451-/nsp,7[\"event\",{\"data\":{\"_placeholder\":true,\"num\":0},\"text\":\"pooled\"}]");
+    CHECK(job->frames[1].first);
+    CHECK(*job->frames[1].second == std::string(10,'x'));
+}
+
+TEST_CASE( "test_packet_manager_event_filter" )
+{
+    packet_manager manager;
+    std::vector<std::string> decoded;
+    manager.set_decode_callback([&](packet const& p)
+    {
+        decoded.push_back(p.get_message()->get_vector()[0]->get_string());
+    });
+    manager.set_event_filter([](std::string const& nsp, std::string const& name)
+    {
+        return nsp == "/nsp" && name == "wanted" ? packet_manager::event_decode_tree : packet_manager::event_drop;
+    });
+    std::string attachment(10,'x');
+    attachment[0] = packet::frame_message;
+
+    manager.put_payload(std::string("42/nsp,[\"ignored\",{\"big\":[1,2,3]}]"));
+    //dropped binary event, its attachment is discarded as well.
+    manager.put_payload(std::string("451-/nsp,[\"ignored\",{\"_placeholder\":true,\"num\":0}]"));
+    manager.put_payload(attachment);
+    //an ack is owed, so this one is decoded anyway.
+    manager.put_payload(std::string("42/nsp,12[\"ignored\"]"));
+    manager.put_payload(std::string("451-/nsp,[\"wanted\",{\"_placeholder\":true,\"num\":0}]"));
+    manager.put_payload(attachment);
+
+    REQUIRE(decoded.size() == 2);
+    CHECK(decoded[0] == "ignored");
+    CHECK(decoded[1] == "wanted");
+
+    std::string nsp, name;
+    int pack_id;
+    unsigned attachments;
+    CHECK(packet::peek_event("452-/nsp,7[ \"upload\",{}]", nsp, name, pack_id, attachments));
+    CHECK(nsp == "/nsp");
+    CHECK(name == "upload");
+    CHECK(pack_id == 7);
+    CHECK(attachments == 2);
+    CHECK(!packet::peek_event("43/nsp,7[\"ack\"]", nsp, name, pack_id, attachments));
+    CHECK(!packet::peek_event("42[\"esc\\\"aped\"]", nsp, name, pack_id, attachments));
+}
+
+TEST_CASE( "test_packet_read_header" )
+{
+    packet::header h;
+    std::string frame("452-/chat,4711[\"ev\"]");
+    CHECK(packet::read_header(frame.data(), frame.size(), h) == frame.find('['));
+    CHECK(h.frame == packet::frame_message);
+    CHECK(h.type == packet::type_binary_event);
+    CHECK(h.attachments == 2);
+    CHECK(std::string(h.nsp, h.nsp_length) == "/chat");
+    CHECK(h.pack_id == 4711);
+
+    frame = "4312[]";
+    CHECK(packet::read_header(frame.data(), frame.size(), h) == 4);
+    CHECK(h.nsp == NULL);
+    CHECK(h.pack_id == 12);
+
+    frame = "40/admin";
+    CHECK(packet::read_header(frame.data(), frame.size(), h) == std::string::npos);
+    CHECK(std::string(h.nsp, h.nsp_length) == "/admin");
+
+    //malformed headers are rejected instead of throwing.
+    frame = "451[]";
+    CHECK(packet::read_header(frame.data(), frame.size(), h) == std::string::npos);
+    frame = "45x-[]";
+    CHECK(packet::read_header(frame.data(), frame.size(), h) == std::string::npos);
+    frame = "4299999999999[]";
+    CHECK(packet::read_header(frame.data(), frame.size(), h) == 13);
+    CHECK(h.pack_id == -1);
+    frame = "421a[]";
+    CHECK(packet::read_header(frame.data(), frame.size(), h) == 4);
+    CHECK(h.pack_id == -1);
+}
+
+TEST_CASE( "test_packet_manager_stream" )
+{
+    packet_manager manager;
+    size_t decoded = 0;
+    manager.set_decode_callback([&](packet const&)
+    {
+        ++decoded;
+    });
+    manager.set_event_filter([](std::string const&, std::string const& name)
+    {
+        return name == "upload" ? packet_manager::event_stream : packet_manager::event_decode_tree;
+    });
+    std::vector<size_t> sizes;
+    std::vector<bool> lasts;
+    message::ptr header;
+    size_t cut_short = 0;
+    manager.set_stream_callback([&](packet const& p, std::shared_ptr<const std::string> const& attachment, bool last)
+    {
+        if(!attachment)
+        {
+            if(last)
+            {
+                ++cut_short;
+                return;
+            }
+            header = p.get_message();
+            return;
+        }
+        sizes.push_back(attachment->size());
+        lasts.push_back(last);
+    });
+
+    manager.put_payload(std::string("452-[\"upload\",{\"name\":\"a.bin\",\"part\":{\"_placeholder\":true,\"num\":0}},{\"_placeholder\":true,\"num\":1}]"));
+    REQUIRE(header);
+    //placeholders are not resolved, the attachments are only announced.
+    message::ptr part = header->get_vector()[1]->get_map()["part"];
+    REQUIRE(part->get_flag() == message::flag_object);
+    CHECK(part->get_map()["num"]->get_int() == 0);
+    CHECK(sizes.empty());
+
+    std::string attachment(100,'x');
+    attachment[0] = packet::frame_message;
+    manager.put_payload(attachment);
+    REQUIRE(sizes.size() == 1);
+    CHECK(!lasts[0]);
+    manager.put_payload(attachment.substr(0,40));
+    REQUIRE(sizes.size() == 2);
+    CHECK(sizes[1] == 40);
+    CHECK(lasts[1]);
+    CHECK(decoded == 0);
+
+    //without attachments there is nothing to stream.
+    manager.put_payload(std::string("42[\"upload\",{}]"));
+    CHECK(decoded == 1);
+    CHECK(sizes.size() == 2);
+    CHECK(cut_short == 0);
+
+    //a text frame before the last attachment cuts the streamed event short.
+    manager.put_payload(std::string("451-[\"upload\",{\"_placeholder\":true,\"num\":0}]"));
+    manager.put_payload(std::string("42[\"other\"]"));
+    CHECK(cut_short == 1);
+    CHECK(decoded == 2);
+    manager.put_payload(attachment);
+    CHECK(sizes.size() == 2);
+}
+
 TEST_CASE( "test_packet_parse_1" )
 {
     packet p;
@@ -203,6 +535,56 @@ TEST_CASE( "test_packet_parse_3" )
     CHECK(p.get_message()->get_flag() == message::flag_string);
 }
 
+TEST_CASE( "test_packet_parse_insitu" )
+{
+    const std::string frame = "42/nsp,7[\"event\",{\"text\":\"line\\nbreak \\u00e9\",\"list\":[\"a\\\"b\",1]}]";
+    packet copied;
+    CHECK(!copied.parse(frame));
+    packet insitu;
+    CHECK(!insitu.parse(std::string(frame)));
+    packet* packets[] = { &copied, &insitu };
+    for(packet* p : packets)
+    {
+        CHECK(p->get_nsp() == "/nsp");
+        CHECK(p->get_pack_id() == 7);
+        message::ptr msg = p->get_message();
+        REQUIRE(msg->get_flag() == message::flag_array);
+        CHECK(msg->get_vector()[0]->get_string() == "event");
+        message::ptr obj = msg->get_vector()[1];
+        REQUIRE(obj->get_flag() == message::flag_object);
+        CHECK(obj->get_map()["text"]->get_string() == "line\nbreak \xc3\xa9");
+        CHECK(obj->get_map()["list"]->get_vector()[0]->get_string() == "a\"b");
+        CHECK(obj->get_map()["list"]->get_vector()[1]->get_int() == 1);
+    }
+}
+
+TEST_CASE( "test_packet_parse_lazy" )
+{
+    packet p;
+    CHECK(!p.parse(std::string("42/nsp,[\"event\", {\"user\":{\"name\":\"melo\",\"tags\":[1,2.5,null]},\"ok\":true}, [\"a\\\"b\"]]"), true));
+    message::ptr msg = p.get_message();
+    REQUIRE(msg->get_flag() == message::flag_array);
+    CHECK(msg->get_raw_json() == "[\"event\", {\"user\":{\"name\":\"melo\",\"tags\":[1,2.5,null]},\"ok\":true}, [\"a\\\"b\"]]");
+    REQUIRE(msg->get_vector().size() == 3);
+    CHECK(msg->get_vector()[0]->get_string() == "event");
+    message::ptr obj = msg->get_vector()[1];
+    REQUIRE(obj->get_flag() == message::flag_object);
+    CHECK(obj->get_raw_json() == "{\"user\":{\"name\":\"melo\",\"tags\":[1,2.5,null]},\"ok\":true}");
+    CHECK(obj->get_map()["ok"]->get_bool());
+    message::ptr user = obj->get_map()["user"];
+    CHECK(user->get_raw_json() == "{\"name\":\"melo\",\"tags\":[1,2.5,null]}");
+    CHECK(user->get_map()["name"]->get_string() == "melo");
+    message::ptr tags = user->get_map()["tags"];
+    REQUIRE(tags->get_vector().size() == 3);
+    CHECK(tags->get_vector()[0]->get_int() == 1);
+    CHECK(tags->get_vector()[1]->get_double() == 2.5);
+    CHECK(tags->get_vector()[2]->get_flag() == message::flag_null);
+    CHECK(msg->get_vector()[2]->get_vector()[0]->get_string() == "a\"b");
+
+    //binary events are decoded eagerly.
+    CHECK(p.parse(std::string("451-[\"bin\",{\"_placeholder\":true,\"num\":0}]"), true));
+}
+
 TEST_CASE( "test_packet_parse_4" )
 {
     packet p;
@@ -234,3 +616,743 @@ TEST_CASE( "test_packet_parse_4" )
     CHECK(array->get_vector()[2]->get_string() == "text");
 
 }
+
+TEST_CASE( "test_packet_parse_placeholders" )
+{
+    packet p;
+    CHECK(p.parse(std::string("452-[\"bin\",{\"num\":1,\"_placeholder\":true},{\"_placeholder\":false,\"num\":0},[{\"_placeholder\":true,\"num\":0},{\"_placeholder\":true,\"num\":9}]]")));
+    std::string frame(3,'a');
+    frame[0] = packet::frame_message;
+    CHECK(p.parse_buffer(frame));
+    frame.append("bc");
+    CHECK(!p.parse_buffer(frame));
+    message::ptr msg = p.get_message();
+    REQUIRE(msg);
+    REQUIRE(msg->get_vector().size() == 4);
+    REQUIRE(msg->get_vector()[1]->get_flag() == message::flag_binary);
+    CHECK(msg->get_vector()[1]->get_binary()->size() == 5);
+    //only a true _placeholder refers to an attachment.
+    REQUIRE(msg->get_vector()[2]->get_flag() == message::flag_object);
+    CHECK(msg->get_vector()[2]->get_map()["num"]->get_int() == 0);
+    message::ptr nested = msg->get_vector()[3];
+    REQUIRE(nested->get_vector().size() == 2);
+    CHECK(nested->get_vector()[0]->get_binary()->size() == 3);
+    CHECK(!nested->get_vector()[1]);
+
+    packet big;
+    std::string json("42[\"big\",[");
+    for(int i = 0; i < 1000; ++i)
+    {
+        json.append(i ? ",{\"i\":" : "{\"i\":").append(std::to_string(i)).append("}");
+    }
+    json.append("]]");
+    CHECK(!big.parse(json));
+    message::ptr items = big.get_message()->get_vector()[1];
+    REQUIRE(items->get_vector().size() == 1000);
+    CHECK(items->get_vector().capacity() == 1000);
+    CHECK(items->get_vector()[999]->get_map()["i"]->get_int() == 999);
+
+    packet bad;
+    CHECK(!bad.parse(std::string("42[\"broken\",")));
+    REQUIRE(bad.get_message());
+    CHECK(bad.get_message()->get_flag() == message::flag_null);
+}
+
+TEST_CASE( "test_packet_parse_buffer_moves" )
+{
+    packet p;
+    CHECK(p.parse(std::string("451-/nsp,[\"bin_event\",{\"_placeholder\":true,\"num\":0}]")));
+    std::string frame(4096,'x');
+    frame[0] = packet::frame_message;
+    const char* storage = frame.data();
+    CHECK(!p.parse_buffer(std::move(frame)));
+    message::ptr msg = p.get_message();
+    REQUIRE(msg);
+    REQUIRE(msg->get_vector()[1]->get_flag() == message::flag_binary);
+    //the attachment is the frame's own buffer, not a copy.
+    CHECK(msg->get_vector()[1]->get_binary()->data() == storage);
+    CHECK(msg->get_vector()[1]->get_binary()->size() == 4096);
+}
+
+struct typed_point
+{
+    int x = 0;
+    int y = 0;
+};
+
+struct typed_shape
+{
+    std::string name;
+    std::vector<typed_point> points;
+    double scale = 1;
+    bool closed = false;
+    std::shared_ptr<const std::string> blob;
+};
+
+namespace sio
+{
+    template<> struct reflect<typed_point>
+    {
+        template<typename V> static void visit(V& v) { v("x",&typed_point::x); v("y",&typed_point::y); }
+    };
+
+    template<> struct reflect<typed_shape>
+    {
+        template<typename V> static void visit(V& v)
+        {
+            v("name",&typed_shape::name);
+            v("points",&typed_shape::points);
+            v("scale",&typed_shape::scale);
+            v("closed",&typed_shape::closed);
+            v("blob",&typed_shape::blob);
+        }
+    };
+}
+
+TEST_CASE( "test_typed_from_message" )
+{
+    packet p;
+    CHECK(!p.parse(std::string("42[\"shape\",{\"name\":\"tri\",\"extra\":{\"deep\":[1,{}]},\"points\":[{\"x\":1,\"y\":2},{\"y\":-4,\"x\":3}],\"scale\":2,\"closed\":true}]"), true));
+    message::ptr arg = p.get_message()->get_vector()[1];
+    CHECK(!arg->get_raw_json().empty());
+    typed_shape shape;
+    REQUIRE(from_message(arg, shape));
+    CHECK(shape.name == "tri");
+    REQUIRE(shape.points.size() == 2);
+    CHECK(shape.points[0].x == 1);
+    CHECK(shape.points[0].y == 2);
+    CHECK(shape.points[1].x == 3);
+    CHECK(shape.points[1].y == -4);
+    CHECK(shape.scale == 2);
+    CHECK(shape.closed);
+
+    //once its children are decoded and changed, they are walked instead of the text received.
+    arg->get_map()["name"] = string_message::create("quad");
+    typed_shape changed;
+    REQUIRE(from_message(arg, changed));
+    CHECK(changed.name == "quad");
+    CHECK(changed.points.size() == 2);
+
+    //decoded trees are walked, binaries included.
+    message::ptr tree = object_message::create();
+    tree->get_map()["name"] = string_message::create("bin");
+    tree->get_map()["blob"] = binary_message::create(std::make_shared<std::string>("abc"));
+    typed_shape with_blob;
+    REQUIRE(from_message(tree, with_blob));
+    CHECK(with_blob.name == "bin");
+    REQUIRE(with_blob.blob);
+    CHECK(*with_blob.blob == "abc");
+    CHECK(with_blob.points.empty());
+
+    typed_point point;
+    tree = object_message::create();
+    tree->get_map()["x"] = string_message::create("1");
+    CHECK(!from_message(tree, point));
+    std::vector<int> numbers;
+    CHECK(!from_message(message::ptr(), numbers));
+    CHECK(from_message(array_message::create(), numbers));
+
+    //negative numbers are out of range for unsigned types, uint64_t included.
+    uint32_t u32 = 0;
+    uint64_t u64 = 0;
+    CHECK(!from_message(int_message::create(-1), u32));
+    CHECK(!from_message(int_message::create(-1), u64));
+    CHECK(u64 == 0);
+    CHECK(from_message(int_message::create(7), u64));
+    CHECK(u64 == 7);
+}
+
+TEST_CASE( "test_packet_accept_typed" )
+{
+    typed_shape shape;
+    shape.name = "line";
+    typed_point a;
+    a.x = 1;
+    a.y = -2;
+    shape.points.push_back(a);
+    shape.closed = true;
+    std::shared_ptr<const std::string> prefix = packet::encode_event_prefix("shape");
+    packet p("/nsp",prefix,std::make_shared<typed_args<typed_shape,int,std::string> >(shape,7,std::string("tail")));
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    CHECK(!p.accept(payload,buffers));
+    CHECK(p.get_type() == packet::type_event);
+    CHECK(payload == "42/nsp,[\"shape\",{\"name\":\"line\",\"points\":[{\"x\":1,\"y\":-2}],\"scale\":1.0,\"closed\":true,\"blob\":null},7,\"tail\"]");
+
+    shape.blob = std::make_shared<const std::string>(10,'x');
+    packet p2("/",prefix,std::make_shared<typed_args<typed_shape> >(shape));
+    std::string payload2;
+    CHECK(p2.accept(payload2,buffers));
+    CHECK(p2.get_type() == packet::type_binary_event);
+    REQUIRE(buffers.size() == 1);
+    CHECK(buffers[0] == shape.blob);
+    CHECK(payload2 == "451-[\"shape\",{\"name\":\"line\",\"points\":[{\"x\":1,\"y\":-2}],\"scale\":1.0,\"closed\":true,\"blob\":{\"_placeholder\":true,\"num\":0}}]");
+
+    //what goes out decodes back through the typed reader.
+    packet back;
+    CHECK(back.parse(payload2));
+    CHECK(!back.parse_buffer(*buffers[0]));
+    typed_shape decoded;
+    REQUIRE(from_message(back.get_message()->get_vector()[1], decoded));
+    CHECK(decoded.name == "line");
+    REQUIRE(decoded.points.size() == 1);
+    CHECK(decoded.points[0].y == -2);
+    REQUIRE(decoded.blob);
+    CHECK(*decoded.blob == *shape.blob);
+}
+
+TEST_CASE( "test_typed_uint64" )
+{
+    //values above INT64_MAX are written unsigned instead of wrapping negative.
+    const uint64_t big = std::numeric_limits<uint64_t>::max();
+    packet p("/",packet::encode_event_prefix("big"),std::make_shared<typed_args<uint64_t,uint32_t> >(big,7u));
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    CHECK(!p.accept(payload,buffers));
+    CHECK(payload == "42[\"big\",18446744073709551615,7]");
+
+    //and read back into unsigned fields, which are the only ones they fit.
+    packet back;
+    CHECK(!back.parse(std::string("42[\"big\",[18446744073709551615,7]]"), true));
+    message::ptr arg = back.get_message()->get_vector()[1];
+    std::vector<uint64_t> unsigned_values;
+    REQUIRE(from_message(arg, unsigned_values));
+    REQUIRE(unsigned_values.size() == 2);
+    CHECK(unsigned_values[0] == big);
+    CHECK(unsigned_values[1] == 7);
+    std::vector<int64_t> signed_values;
+    CHECK(!from_message(arg, signed_values));
+    std::vector<uint32_t> narrow_values;
+    CHECK(!from_message(arg, narrow_values));
+    std::vector<double> double_values;
+    REQUIRE(from_message(arg, double_values));
+    CHECK(double_values[0] == static_cast<double>(big));
+}
+
+TEST_CASE( "test_value" )
+{
+    value v;
+    v["name"] = "line";
+    v["points"].push(1);
+    v["points"].push(-2.5);
+    v["points"].push(value());
+    v["closed"] = true;
+    CHECK(v.get_flag() == message::flag_object);
+    CHECK(v.size() == 3);
+    CHECK(v["points"][1].get_double() == -2.5);
+    CHECK(v.find("missing") == nullptr);
+    value copy = v;
+    CHECK(copy == v);
+    copy["closed"] = false;
+    CHECK(copy != v);
+
+    //the non-const getters turn a null value into the container they return.
+    value list;
+    list.get_vector().push_back(value(1));
+    CHECK(list.get_flag() == message::flag_array);
+    CHECK(list.size() == 1);
+    value members;
+    members.get_members().push_back(value::member("k", value(2)));
+    CHECK(members.get_flag() == message::flag_object);
+    REQUIRE(members.find("k") != nullptr);
+    CHECK(members.find("k")->get_int() == 2);
+
+    std::shared_ptr<const std::string> prefix = packet::encode_event_prefix("value");
+    packet p("/",prefix,std::make_shared<typed_args<value> >(v));
+    std::string payload;
+    std::vector<std::shared_ptr<const std::string> > buffers;
+    CHECK(!p.accept(payload,buffers));
+    CHECK(payload == "42[\"value\",{\"name\":\"line\",\"points\":[1,-2.5,null],\"closed\":true}]");
+
+    //read back from the json text, without a message tree.
+    packet back;
+    CHECK(!back.parse(std::move(payload), true));
+    value decoded;
+    REQUIRE(from_message(back.get_message()->get_vector()[1], decoded));
+    CHECK(decoded == v);
+    CHECK(decoded.get_members()[0].key == "name");
+
+    v["blob"] = std::make_shared<const std::string>("abc");
+    packet binary("/",prefix,std::make_shared<typed_args<value> >(v));
+    std::string payload2;
+    CHECK(binary.accept(payload2,buffers));
+    REQUIRE(buffers.size() == 1);
+    CHECK(*buffers[0] == "abc");
+    packet binary_back;
+    CHECK(binary_back.parse(payload2));
+    CHECK(!binary_back.parse_buffer(*buffers[0]));
+    REQUIRE(from_message(binary_back.get_message()->get_vector()[1], decoded));
+    CHECK(decoded == v);
+}
+
+TEST_CASE( "test_packet_parse_buffer_slots" )
+{
+    packet p;
+    std::string json("4520-[\"many\",[");
+    for(int i = 19; i >= 0; --i)
+    {
+        json.append("{\"_placeholder\":true,\"num\":").append(std::to_string(i)).append(i ? "}," : "}");
+    }
+    json.append("]]");
+    CHECK(p.parse(json));
+    for(int i = 0; i < 20; ++i)
+    {
+        std::string frame(i + 1, 'x');
+        frame[0] = packet::frame_message;
+        CHECK(p.parse_buffer(std::move(frame)) == (i < 19));
+    }
+    std::vector<message::ptr> const& args = p.get_message()->get_vector()[1]->get_vector();
+    REQUIRE(args.size() == 20);
+    for(int i = 0; i < 20; ++i)
+    {
+        std::shared_ptr<const std::string> const& data = args[i]->get_binary();
+        CHECK(data->size() == static_cast<size_t>(20 - i));
+        //the slot handed its attachment over, the message holds the only reference.
+        CHECK(data.use_count() == 1);
+    }
+
+    packet twice;
+    CHECK(twice.parse(std::string("451-[\"twice\",{\"_placeholder\":true,\"num\":0},{\"_placeholder\":true,\"num\":0}]")));
+    std::string frame(4, 'x');
+    frame[0] = packet::frame_message;
+    CHECK(!twice.parse_buffer(frame));
+    REQUIRE(twice.get_message()->get_vector()[1]);
+    CHECK(!twice.get_message()->get_vector()[2]);
+}
+
+TEST_CASE( "test_message_arena" )
+{
+    message::ptr root;
+    {
+        message_arena arena(64);
+        root = object_message::create(arena);
+        message::ptr list = array_message::create(arena);
+        list->get_vector().push_back(int_message::create(7,arena));
+        list->get_vector().push_back(string_message::create(std::string("text"),arena));
+        list->get_vector().push_back(null_message::create(arena));
+        root->get_map()["list"] = list;
+        root->get_map()["flag"] = bool_message::create(true,arena);
+        root->get_map()["ratio"] = double_message::create(0.5,arena);
+    }
+    //the nodes keep the arena alive after the last message_arena copy is gone.
+    std::vector<message::ptr> const& list = root->get_map()["list"]->get_vector();
+    REQUIRE(list.size() == 3);
+    CHECK(list[0]->get_int() == 7);
+    CHECK(list[1]->get_string() == "text");
+    CHECK(list[2]->get_flag() == message::flag_null);
+    CHECK(root->get_map()["flag"]->get_bool());
+    CHECK(root->get_map()["ratio"]->get_double() == 0.5);
+
+    packet p;
+    p.set_arena_decode(true);
+    CHECK(p.parse(std::string("451-[\"arena\",{\"n\":[1,-2,3.5,\"s\",false,null]},{\"_placeholder\":true,\"num\":0}]")));
+    std::string frame("xabc");
+    frame[0] = packet::frame_message;
+    CHECK(!p.parse_buffer(std::move(frame)));
+    std::vector<message::ptr> const& args = p.get_message()->get_vector();
+    REQUIRE(args.size() == 3);
+    CHECK(args[0]->get_string() == "arena");
+    std::vector<message::ptr> const& n = args[1]->get_map()["n"]->get_vector();
+    REQUIRE(n.size() == 6);
+    CHECK(n[0]->get_int() == 1);
+    CHECK(n[1]->get_int() == -2);
+    CHECK(n[2]->get_double() == 3.5);
+    CHECK(n[3]->get_string() == "s");
+    CHECK(!n[4]->get_bool());
+    CHECK(n[5]->get_flag() == message::flag_null);
+    CHECK(*args[2]->get_binary() == "abc");
+}
+
+TEST_CASE( "test_message_ptr" )
+{
+    //holds for std::shared_ptr and for the SIO_INTRUSIVE_MESSAGE_PTR handle alike.
+    message::ptr msg = string_message::create(std::string("text"));
+    message::ptr copy = msg;
+    CHECK(msg.use_count() == 2);
+    CHECK(copy == msg);
+
+    message::ptr arr = message::list(msg).to_array_message("event");
+    CHECK(msg.use_count() == 3);
+    arr.reset();
+    CHECK(msg.use_count() == 2);
+
+    message::ptr moved(std::move(copy));
+    CHECK(!copy);
+    CHECK(copy == nullptr);
+    CHECK(moved.get() == msg.get());
+    CHECK(msg.use_count() == 2);
+    moved = nullptr;
+    CHECK(msg.use_count() == 1);
+
+    message::ptr node;
+    {
+        message_arena arena;
+        node = string_message::create(std::string("in arena"),arena);
+        message::ptr other = node;
+        CHECK(node.use_count() == 2);
+    }
+    CHECK(node.use_count() == 1);
+    CHECK(node->get_string() == "in arena");
+}
+
+TEST_CASE( "test_message_shared_scalars" )
+{
+    //the library is built with the default range, -16 to 255.
+#ifndef SIO_SINGLE_THREADED_MESSAGES
+    CHECK(null_message::create() == null_message::create());
+    CHECK(bool_message::create(true) == bool_message::create(true));
+    CHECK(bool_message::create(true) != bool_message::create(false));
+    CHECK(!bool_message::create(false)->get_bool());
+    CHECK(int_message::create(255) == int_message::create(255));
+    CHECK(int_message::create(-16)->get_int() == -16);
+    CHECK(int_message::create(256) != int_message::create(256));
+    CHECK(int_message::create(-17) != int_message::create(-17));
+    CHECK(int_message::create(256)->get_int() == 256);
+
+    message_arena arena;
+    CHECK(int_message::create(1,arena) == int_message::create(1));
+
+    packet p;
+    CHECK(!p.parse(std::string("42[\"flags\",{\"on\":true,\"off\":false,\"count\":1,\"none\":null}]")));
+    std::map<std::string,message::ptr> const& flags = p.get_message()->get_vector()[1]->get_map();
+    CHECK(flags.at("on") == bool_message::create(true));
+    CHECK(flags.at("off") == bool_message::create(false));
+    CHECK(flags.at("count") == int_message::create(1));
+    CHECK(flags.at("none") == null_message::create());
+#else
+    //SIO_SINGLE_THREADED_MESSAGES clients can't share instances.
+    CHECK(null_message::create() != null_message::create());
+    CHECK(int_message::create(1) != int_message::create(1));
+#endif
+}
+
+TEST_CASE( "test_message_list_moves" )
+{
+    message::ptr empty_array;
+    size_t array_allocations = count_allocations([&]
+    {
+        empty_array = array_message::create();
+    });
+
+    message::list args;
+    for(int i = 0; i < 8; ++i)
+    {
+        args.push(string_message::create(std::string("argument")));
+    }
+    message::ptr first = args[0];
+
+    //copying takes one vector buffer and a reference to every element.
+    message::ptr copied;
+    CHECK(count_allocations([&]
+    {
+        copied = args.to_array_message();
+    }) == array_allocations + 1);
+    CHECK(first.use_count() == 3);
+    copied.reset();
+
+    //moving takes the list's buffer as is.
+    message::list moved_args(args);
+    message::ptr moved;
+    CHECK(count_allocations([&]
+    {
+        moved = std::move(moved_args).to_array_message();
+    }) == array_allocations);
+    CHECK(moved_args.size() == 0);
+    CHECK(moved->get_vector().size() == 8);
+    CHECK(first.use_count() == 3);
+
+    //with the event name the elements are moved into one exactly sized buffer.
+    message::list named_args(args);
+    message::ptr name = string_message::create(std::string("event"));
+    size_t name_allocations = count_allocations([&]
+    {
+        name = string_message::create(std::string("event"));
+    });
+    message::ptr named;
+    CHECK(count_allocations([&]
+    {
+        named = std::move(named_args).to_array_message("event");
+    }) == array_allocations + name_allocations + 1);
+    CHECK(named->get_vector().size() == 9);
+    CHECK(first.use_count() == 4);
+
+    message::list assigned;
+    assigned = std::move(args);
+    CHECK(args.size() == 0);
+    CHECK(assigned.size() == 8);
+    CHECK(first.use_count() == 4);
+
+    //a batch takes the messages of a moved list without another reference.
+    event_batch batch;
+    batch.add("event", std::move(assigned));
+    CHECK(assigned.size() == 0);
+    CHECK(batch.size() == 1);
+    CHECK(first.use_count() == 4);
+}
+
+TEST_CASE( "test_packet_release_message" )
+{
+    packet_manager manager;
+    message::ptr received;
+    manager.set_decode_callback([&](packet& p)
+    {
+        received = p.release_message();
+        CHECK(!p.get_message());
+    });
+    manager.put_payload(std::string("42[\"event\",1,2]"));
+    REQUIRE(received);
+    //nothing else holds the decoded tree, so socket can move its elements out.
+    CHECK(received.use_count() == 1);
+    CHECK(received->get_vector().size() == 3);
+}
+
+TEST_CASE( "test_mpsc_queue_order" )
+{
+    mpsc_queue<std::string> queue;
+    std::string out;
+    CHECK(!queue.pop(out));
+    queue.push(std::string("a"));
+    queue.push(std::string("b"));
+    CHECK(queue.pop(out));
+    CHECK(out == "a");
+    queue.push(std::string("c"));
+    CHECK(queue.pop(out));
+    CHECK(out == "b");
+    CHECK(queue.pop(out));
+    CHECK(out == "c");
+    CHECK(!queue.pop(out));
+    queue.push(std::string("d"));
+    queue.clear();
+    CHECK(!queue.pop(out));
+}
+
+TEST_CASE( "test_mpsc_queue_producers" )
+{
+    const int producers = 4;
+    const int per_producer = 10000;
+    mpsc_queue<std::pair<int, int> > queue;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < producers; ++i)
+    {
+        threads.push_back(std::thread([&queue, i]()
+        {
+            for(int n = 0; n < per_producer; ++n)
+            {
+                queue.push(std::make_pair(i, n));
+            }
+        }));
+    }
+    std::vector<int> next(producers, 0);
+    int received = 0;
+    bool ordered = true;
+    std::pair<int, int> item;
+    while(received < producers * per_producer)
+    {
+        if(queue.pop(item))
+        {
+            ordered = ordered && item.second == next[item.first];
+            next[item.first] = item.second + 1;
+            ++received;
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+    for(auto& t : threads)
+    {
+        t.join();
+    }
+    CHECK(ordered);
+    CHECK(!queue.pop(item));
+}
+
+namespace
+{
+    //Reads the masked client frame at pos and returns its unmasked payload.
+    std::string read_masked_frame(std::string const& data, size_t& pos, unsigned& opcode, std::string& key)
+    {
+        unsigned char first = data[pos], second = data[pos + 1];
+        CHECK((first & 0x80) != 0);//FIN
+        CHECK((second & 0x80) != 0);//MASK
+        opcode = first & 0x0f;
+        size_t length = second & 0x7f;
+        pos += 2;
+        if(length == 126)
+        {
+            length = (size_t(static_cast<unsigned char>(data[pos])) << 8) | static_cast<unsigned char>(data[pos + 1]);
+            pos += 2;
+        }
+        key = data.substr(pos, 4);
+        pos += 4;
+        std::string payload(length, '\0');
+        for(size_t i = 0; i < length; ++i)
+        {
+            payload[i] = data[pos + i] ^ key[i % 4];
+        }
+        pos += length;
+        return payload;
+    }
+}
+
+TEST_CASE( "test_frame_buffer" )
+{
+    frame_buffer frames;
+    websocketpp::frame::masking_key_type first_key, second_key;
+    first_key.i = 0x12345678;
+    second_key.i = 0x9abcdef0;
+    std::string text = "42/nsp,[\"event\",\"text\"]";
+    std::string binary(300, '\x7f');
+    frames.append(text, websocketpp::frame::opcode::text, first_key);
+    frames.append(binary, websocketpp::frame::opcode::binary, second_key);
+    CHECK(frames.frames() == 2);
+    CHECK(frames.writes() == 0);
+
+    //both frames leave in one write, in the order they were appended.
+    std::string out;
+    frames.take(out);
+    CHECK(frames.empty());
+    CHECK(frames.writes() == 1);
+    size_t pos = 0;
+    unsigned opcode;
+    std::string key;
+    CHECK(read_masked_frame(out, pos, opcode, key) == text);
+    CHECK(opcode == 1);
+    CHECK(key == std::string(reinterpret_cast<char const*>(first_key.c), 4));
+    CHECK(read_masked_frame(out, pos, opcode, key) == binary);
+    CHECK(opcode == 2);
+    CHECK(key == std::string(reinterpret_cast<char const*>(second_key.c), 4));
+    CHECK(pos == out.size());
+
+    //dropped frames are not counted as a write.
+    frames.append(text, websocketpp::frame::opcode::text, first_key);
+    frames.clear();
+    CHECK(frames.empty());
+    CHECK(frames.frames() == 3);
+    CHECK(frames.writes() == 1);
+}
+
+namespace
+{
+    //Keeps what sockets hand over for the wire instead of writing it, and takes packets
+    //as if the server had sent them. Never connects.
+    class capture_client : public client_impl
+    {
+    public:
+        capture_client():
+            client_impl(client_options())
+        {
+        }
+
+        void receive(std::string const& payload)
+        {
+            packet_manager manager;
+            manager.set_decode_callback([this](packet& p)
+            {
+                on_decode(p);
+            });
+            manager.put_payload(payload);
+        }
+
+        using client_impl::socket;
+
+        //runs the drains sockets posted to the network thread.
+        void run_pending()
+        {
+            get_io_service().restart();
+            get_io_service().poll();
+        }
+
+        std::vector<std::string> sent;
+
+    protected:
+        void send_encoded(encoded_packet& out) override
+        {
+            for(auto it = out.frames.begin(); it != out.frames.end(); ++it)
+            {
+                sent.push_back(*it->second);
+            }
+        }
+    };
+
+    //splits "42/batch,<id>[...]" into the pack id (-1 when absent) and the array.
+    int split_pack_id(std::string const& frame, std::string const& prefix, std::string& args)
+    {
+        size_t start = frame.compare(0, prefix.size(), prefix) == 0 ? prefix.size() : 0;
+        size_t end = frame.find('[', start);
+        args = end == std::string::npos ? std::string() : frame.substr(end);
+        return end == start || end == std::string::npos ? -1 : std::stoi(frame.substr(start, end - start));
+    }
+}
+
+TEST_CASE( "test_socket_emit_batch" )
+{
+    capture_client client;
+    socket::ptr s = client.socket("/batch");
+    std::vector<std::string> acked;
+
+    event_batch batch;
+    batch.add("first", int_message::create(1))
+         .add("second", string_message::create("b"), [&](message::list const&)
+         {
+             acked.push_back("second");
+         })
+         .add("third", message::list(), [&](message::list const&)
+         {
+             acked.push_back("third");
+         });
+    s->emit_batch(batch);
+    client.run_pending();
+    //the namespace is not connected yet, the batch stays queued.
+    CHECK(client.sent.empty());
+
+    client.receive("40/batch,{\"sid\":\"s\"}");
+    REQUIRE(client.sent.size() == 3);
+    std::string args;
+    std::string const prefix = "42/batch,";
+    CHECK(split_pack_id(client.sent[0], prefix, args) == -1);
+    CHECK(client.sent[0] == "42/batch,[\"first\",1]");
+    int second_id = split_pack_id(client.sent[1], prefix, args);
+    CHECK(args == "[\"second\",\"b\"]");
+    int third_id = split_pack_id(client.sent[2], prefix, args);
+    CHECK(args == "[\"third\"]");
+    //acks are registered per entry, in batch order.
+    CHECK(second_id >= 0);
+    CHECK(third_id > second_id);
+
+    client.receive("43/batch," + std::to_string(third_id) + "[]");
+    REQUIRE(acked.size() == 1);
+    CHECK(acked[0] == "third");
+    client.receive("43/batch," + std::to_string(second_id) + "[]");
+    REQUIRE(acked.size() == 2);
+    CHECK(acked[1] == "second");
+}
+
+TEST_CASE( "test_socket_emit_typed" )
+{
+    static_assert(has_json_traits<int>::value && has_json_traits<unsigned>::value &&
+                  has_json_traits<int64_t>::value && has_json_traits<uint64_t>::value, "integers are typed arguments");
+    capture_client client;
+    socket::ptr s = client.socket("/typed");
+    client.receive("40/typed,{\"sid\":\"s\"}");
+
+    typed_shape shape;
+    shape.name = "dot";
+    s->emit("shape", shape, 7);
+    //a lone integer is an argument, not a null message list.
+    s->emit("count", 0);
+    s->emit("big", std::numeric_limits<uint64_t>::max());
+    value v;
+    v["closed"] = true;
+    s->emit("value", v);
+    //messages still take the message list overload.
+    s->emit("message", string_message::create("m"));
+    client.run_pending();
+
+    REQUIRE(client.sent.size() == 5);
+    CHECK(client.sent[0] == "42/typed,[\"shape\",{\"name\":\"dot\",\"points\":[],\"scale\":1.0,\"closed\":false,\"blob\":null},7]");
+    CHECK(client.sent[1] == "42/typed,[\"count\",0]");
+    CHECK(client.sent[2] == "42/typed,[\"big\",18446744073709551615]");
+    CHECK(client.sent[3] == "42/typed,[\"value\",{\"closed\":true}]");
+    CHECK(client.sent[4] == "42/typed,[\"message\",\"m\"]");
+}